@@ -0,0 +1,345 @@
+#include "bench.hh"
+#include "ncw.hh"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <getopt.h>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <new>
+#include <thread>
+
+static std::atomic<uint64_t> allocations {0};
+
+void* operator new(size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if(void* ptr = std::malloc(size ? size : 1)) return ptr;
+    throw std::bad_alloc();
+}
+
+void* operator new[](size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if(void* ptr = std::malloc(size ? size : 1)) return ptr;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept { std::free(ptr); }
+void operator delete[](void* ptr) noexcept { std::free(ptr); }
+void operator delete(void* ptr, size_t) noexcept { std::free(ptr); }
+void operator delete[](void* ptr, size_t) noexcept { std::free(ptr); }
+
+namespace ncw {
+    namespace bench {
+
+	using clock = std::chrono::steady_clock;
+
+	// Group 0 holds [0, sub_buckets) exactly; group g > 0 spans
+	// [sub_buckets << (g-1), sub_buckets << g) in slots 2^(g-1) wide.
+	size_t Histogram::index_of(uint64_t value) {
+	    if(value < sub_buckets) return value;
+	    uint32_t shift = 64 - __builtin_clzll(value) - sub_bucket_bits - 1;
+	    return (shift+1)*sub_buckets + (value >> shift) - sub_buckets;
+	}
+
+	uint64_t Histogram::value_of(size_t index) {
+	    uint64_t group = index / sub_buckets;
+	    uint64_t sub = index % sub_buckets;
+	    if(group == 0) return sub;
+	    return ((sub+sub_buckets+1) << (group-1)) - 1;
+	}
+
+	void Histogram::record(uint64_t value) {
+	    counts_[index_of(value)]++;
+	    total_++;
+	    sum_ += value;
+	    min_ = std::min(min_, value);
+	    max_ = std::max(max_, value);
+	}
+
+	void Histogram::merge(const Histogram& other) {
+	    for(size_t i = 0; i < counts_.size(); i++)
+		counts_[i] += other.counts_[i];
+	    total_ += other.total_;
+	    sum_ += other.sum_;
+	    min_ = std::min(min_, other.min_);
+	    max_ = std::max(max_, other.max_);
+	}
+
+	uint64_t Histogram::percentile(double percentile) const {
+	    if(total_ == 0) return 0;
+	    uint64_t target = std::max<uint64_t>(1, std::ceil(total_ * percentile / 100.0));
+	    uint64_t seen {0};
+	    for(size_t i = 0; i < counts_.size(); i++) {
+		seen += counts_[i];
+		if(seen >= target) return std::min(value_of(i), max_);
+	    }
+	    return max_;
+	}
+
+	struct Options {
+	    std::string url {};
+	    std::string method {"GET"};
+	    std::string data {};
+	    uint32_t concurrency {1};
+	    uint64_t duration {10};
+	    uint64_t requests {0};
+	    double rate {0};
+	    bool reuse {true};
+	    uint64_t timeout {inner::http::def_timeout};
+	    SocketOptions socket {};
+	    size_t max_in_flight {0};
+	    double host_rate {0};
+	    std::shared_ptr<Scheduler> scheduler {};
+	    std::string trace {};
+	};
+
+	struct Result {
+	    Histogram latency {};
+	    Histogram service {};
+	    uint64_t completed {0};
+	    uint64_t bytes {0};
+	    uint64_t statuses[6] {};
+	    std::map<std::string, uint64_t> errors {};
+	};
+
+	static Response perform(const Options& options, Session& session) {
+	    const std::string& m = options.method;
+	    if(m == "HEAD") return session.HEAD(options.url);
+	    if(m == "POST") return session.POST(options.url, options.data);
+	    if(m == "PUT") return session.PUT(options.url, options.data);
+	    if(m == "PATCH") return session.PATCH(options.url, options.data);
+	    if(m == "DELETE") return session.DELETE(options.url, options.data);
+	    if(m == "OPTIONS") return session.OPTIONS(options.url);
+	    return session.GET(options.url);
+	}
+
+	static uint64_t micros(clock::duration duration) {
+	    return std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+	}
+
+	// Open-loop workers measure latency from the time a request was
+	// scheduled, not from the time it was sent, so a stalled server is
+	// charged for every request it delayed (coordinated omission). Worker
+	// index starts index/concurrency of an interval late, so the workers
+	// together send evenly spaced requests rather than bursts.
+	static void work(const Options& options, uint32_t index, std::atomic<int64_t>& budget,
+		clock::time_point start, clock::time_point deadline, Result& result) {
+	    std::unique_ptr<Session> session {};
+	    clock::duration interval {};
+	    if(options.rate > 0)
+		interval = std::chrono::duration_cast<clock::duration>(
+			std::chrono::duration<double>(options.concurrency / options.rate));
+	    clock::time_point intended {start + interval*index/options.concurrency};
+
+	    while(true) {
+		if(options.requests) {
+		    if(budget.fetch_sub(1, std::memory_order_relaxed) <= 0) break;
+		} else if(clock::now() >= deadline) break;
+
+		if(options.rate > 0) {
+		    std::this_thread::sleep_until(intended);
+		    if(!options.requests && intended >= deadline) break;
+		}
+		auto sent = clock::now();
+		if(options.rate <= 0) intended = sent;
+
+		try {
+		    if(!options.reuse || !session) {
+			session = std::make_unique<Session>(std::string{}, std::map<std::string, std::string>{},
+				std::map<std::string, std::string>{}, options.timeout);
+			session->set_socket_options(options.socket);
+			if(options.scheduler) session->set_scheduler(options.scheduler);
+		    }
+		    auto response = perform(options, *session);
+		    result.bytes += response.data.size();
+		    result.statuses[std::min<uint16_t>(response.status_code/100, 5)]++;
+		} catch(const std::exception& e) {
+		    result.errors[e.what()]++;
+		    session.reset();
+		}
+		auto done = clock::now();
+		result.latency.record(micros(done - intended));
+		result.service.record(micros(done - sent));
+		result.completed++;
+		intended += interval;
+	    }
+	}
+
+	static std::string format_micros(uint64_t us) {
+	    char buffer[32];
+	    if(us >= 1000000) snprintf(buffer, sizeof(buffer), "%.2fs", us/1e6);
+	    else if(us >= 1000) snprintf(buffer, sizeof(buffer), "%.3fms", us/1e3);
+	    else snprintf(buffer, sizeof(buffer), "%luus", static_cast<unsigned long>(us));
+	    return buffer;
+	}
+
+	static void print_histogram(const char* title, const Histogram& histogram) {
+	    std::cout << title << std::endl;
+	    std::cout << "  min " << format_micros(histogram.min())
+		<< "  mean " << format_micros(histogram.mean())
+		<< "  max " << format_micros(histogram.max()) << std::endl;
+	    for(double p: {50.0, 75.0, 90.0, 99.0, 99.9, 99.99, 100.0}) {
+		char line[64];
+		snprintf(line, sizeof(line), "  %8.3f%%  %s", p, format_micros(histogram.percentile(p)).c_str());
+		std::cout << line << std::endl;
+	    }
+	}
+
+	static void usage(const char* name) {
+	    std::cout << "Usage: " << name << " bench [options] <url>" << std::endl;
+	    std::cout << " -c, --concurrency <n>  parallel workers, one connection each (default 1)" << std::endl;
+	    std::cout << " -d, --duration <s>     test duration in seconds (default 10)" << std::endl;
+	    std::cout << " -n, --requests <n>     total number of requests, overrides duration" << std::endl;
+	    std::cout << " -r, --rate <rps>       open-loop target rate across all workers" << std::endl;
+	    std::cout << " -m, --method <method>  request method (default GET)" << std::endl;
+	    std::cout << " -b, --body <data>      request body" << std::endl;
+	    std::cout << " -t, --timeout <s>      receive timeout in seconds" << std::endl;
+	    std::cout << "     --no-reuse         open a new connection for every request" << std::endl;
+	    std::cout << "     --no-nodelay       leave Nagle's algorithm enabled" << std::endl;
+	    std::cout << "     --fastopen         use TCP Fast Open on connect" << std::endl;
+	    std::cout << "     --no-quickack      allow delayed ACKs while reading responses" << std::endl;
+	    std::cout << "     --rcvbuf <bytes>   SO_RCVBUF size" << std::endl;
+	    std::cout << "     --sndbuf <bytes>   SO_SNDBUF size" << std::endl;
+	    std::cout << "     --busy-poll <us>   SO_BUSY_POLL budget" << std::endl;
+	    std::cout << "     --io-uring         use the io_uring backend for plain HTTP" << std::endl;
+	    std::cout << "     --unix-socket <path> send every request over this Unix domain socket" << std::endl;
+	    std::cout << "     --max-in-flight <n> share a scheduler capping in-flight requests per origin" << std::endl;
+	    std::cout << "     --host-rate <rps>  share a scheduler with a per-origin token bucket" << std::endl;
+	    std::cout << "     --trace <file>     record request phases as Chrome trace-event JSON" << std::endl;
+	}
+
+	int run(int argc, char** argv) {
+	    Options options {};
+	    const struct option long_options[] {
+		{"concurrency", required_argument, nullptr, 'c'},
+		{"duration", required_argument, nullptr, 'd'},
+		{"requests", required_argument, nullptr, 'n'},
+		{"rate", required_argument, nullptr, 'r'},
+		{"method", required_argument, nullptr, 'm'},
+		{"body", required_argument, nullptr, 'b'},
+		{"timeout", required_argument, nullptr, 't'},
+		{"no-reuse", no_argument, nullptr, 'N'},
+		{"no-nodelay", no_argument, nullptr, 'D'},
+		{"fastopen", no_argument, nullptr, 'F'},
+		{"no-quickack", no_argument, nullptr, 'Q'},
+		{"rcvbuf", required_argument, nullptr, 'R'},
+		{"sndbuf", required_argument, nullptr, 'S'},
+		{"busy-poll", required_argument, nullptr, 'B'},
+		{"io-uring", no_argument, nullptr, 'U'},
+		{"unix-socket", required_argument, nullptr, 'X'},
+		{"max-in-flight", required_argument, nullptr, 'I'},
+		{"host-rate", required_argument, nullptr, 'H'},
+		{"trace", required_argument, nullptr, 'T'},
+		{nullptr, 0, nullptr, 0},
+	    };
+	    int opt;
+	    while((opt = getopt_long(argc, argv, "c:d:n:r:m:b:t:", long_options, nullptr)) != -1) {
+		switch(opt) {
+		    case 'c': options.concurrency = std::max(1, std::atoi(optarg)); break;
+		    case 'd': options.duration = std::strtoull(optarg, nullptr, 10); break;
+		    case 'n': options.requests = std::strtoull(optarg, nullptr, 10); break;
+		    case 'r': options.rate = std::atof(optarg); break;
+		    case 'm': options.method = optarg; break;
+		    case 'b': options.data = optarg; break;
+		    case 't': options.timeout = std::strtoull(optarg, nullptr, 10); break;
+		    case 'N': options.reuse = false; break;
+		    case 'D': options.socket.tcp_nodelay = false; break;
+		    case 'F': options.socket.tcp_fastopen = true; break;
+		    case 'Q': options.socket.tcp_quickack = false; break;
+		    case 'R': options.socket.recv_buffer = std::atoi(optarg); break;
+		    case 'S': options.socket.send_buffer = std::atoi(optarg); break;
+		    case 'B': options.socket.busy_poll = std::atoi(optarg); break;
+		    case 'U': options.socket.io_backend = IoBackend::io_uring; break;
+		    case 'X': options.socket.unix_socket = optarg; break;
+		    case 'I': options.max_in_flight = std::strtoull(optarg, nullptr, 10); break;
+		    case 'H': options.host_rate = std::atof(optarg); break;
+		    case 'T': options.trace = optarg; break;
+		    default: usage(argv[0]); return 1;
+		}
+	    }
+	    if(optind >= argc) {
+		usage(argv[0]);
+		return 1;
+	    }
+	    options.url = argv[optind];
+	    if(options.max_in_flight || options.host_rate > 0) {
+		size_t limit = options.max_in_flight ? options.max_in_flight : options.concurrency;
+		options.scheduler = std::make_shared<Scheduler>(limit, limit);
+		if(options.host_rate > 0) options.scheduler->set_rate_limit(options.url, options.host_rate);
+	    }
+
+	    std::cout << "Running " << (options.requests ? std::to_string(options.requests) + " requests"
+		    : std::to_string(options.duration) + "s") << " @ " << options.url << std::endl;
+	    std::cout << "  " << options.concurrency << " workers, "
+		<< (options.reuse ? "keep-alive" : "new connection per request") << ", "
+		<< (options.socket.tcp_nodelay ? "nodelay" : "nagle") << ", ";
+	    if(options.socket.tcp_fastopen) std::cout << "fastopen, ";
+	    if(!options.socket.tcp_quickack) std::cout << "delayed ack, ";
+	    if(options.socket.io_backend == IoBackend::io_uring) std::cout << "io_uring, ";
+	    if(!options.socket.unix_socket.empty()) std::cout << "unix socket " << options.socket.unix_socket << ", ";
+	    if(options.rate > 0) std::cout << "open loop at " << options.rate << " req/s" << std::endl;
+	    else std::cout << "closed loop" << std::endl;
+
+	    std::vector<Result> results(options.concurrency);
+	    std::vector<std::thread> workers {};
+	    std::atomic<int64_t> budget {static_cast<int64_t>(options.requests)};
+	    if(!options.trace.empty()) trace::start();
+	    uint64_t allocations_before = allocations.load();
+	    auto start = clock::now();
+	    auto deadline = start + std::chrono::seconds(options.duration);
+	    for(uint32_t i = 0; i < options.concurrency; i++)
+		workers.emplace_back(work, std::cref(options), i, std::ref(budget), start, deadline, std::ref(results[i]));
+	    for(auto& worker: workers) worker.join();
+	    double elapsed = std::chrono::duration<double>(clock::now() - start).count();
+	    uint64_t allocated = allocations.load() - allocations_before;
+	    if(!options.trace.empty()) {
+		trace::stop();
+		trace::save(options.trace);
+	    }
+
+	    Result total {};
+	    for(const auto& result: results) {
+		total.latency.merge(result.latency);
+		total.service.merge(result.service);
+		total.completed += result.completed;
+		total.bytes += result.bytes;
+		for(int i = 0; i < 6; i++) total.statuses[i] += result.statuses[i];
+		for(const auto& error: result.errors) total.errors[error.first] += error.second;
+	    }
+	    uint64_t errors {0};
+	    for(const auto& error: total.errors) errors += error.second;
+
+	    if(options.rate > 0) {
+		print_histogram("Latency (corrected for coordinated omission)", total.latency);
+		print_histogram("Service time", total.service);
+	    } else print_histogram("Latency", total.latency);
+
+	    char line[128];
+	    snprintf(line, sizeof(line), "%lu requests in %.2fs, %.2f MB read",
+		    static_cast<unsigned long>(total.completed), elapsed, total.bytes/1e6);
+	    std::cout << line << std::endl;
+	    snprintf(line, sizeof(line), "Requests/sec: %.2f", total.completed/elapsed);
+	    std::cout << line << std::endl;
+	    snprintf(line, sizeof(line), "Transfer/sec: %.2f MB", total.bytes/1e6/elapsed);
+	    std::cout << line << std::endl;
+	    snprintf(line, sizeof(line), "Allocations/request: %.1f",
+		    total.completed ? static_cast<double>(allocated)/total.completed : 0.0);
+	    std::cout << line << std::endl;
+	    std::cout << "Status:";
+	    for(int i = 1; i < 6; i++)
+		if(total.statuses[i]) std::cout << " " << i << "xx=" << total.statuses[i];
+	    std::cout << std::endl;
+	    std::cout << "Errors: " << errors << std::endl;
+	    for(const auto& error: total.errors)
+		std::cout << "  " << error.first << ": " << error.second << std::endl;
+	    return errors ? 2 : 0;
+	}
+
+    }
+}
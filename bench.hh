@@ -0,0 +1,47 @@
+#ifndef NCW_BENCH_H_
+#define NCW_BENCH_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace ncw {
+    namespace bench {
+
+	// Log-linear latency histogram (HDR-style): values are grouped by
+	// power of two and every group is split into sub_buckets linear slots,
+	// which keeps relative error below 1/sub_buckets over the whole range.
+	class Histogram {
+	    private:
+		static constexpr uint32_t sub_bucket_bits {7};
+		static constexpr uint32_t sub_buckets {1u << sub_bucket_bits};
+		static constexpr uint32_t groups {64 - sub_bucket_bits};
+
+		std::vector<uint64_t> counts_;
+		uint64_t total_ {0};
+		uint64_t min_ {UINT64_MAX};
+		uint64_t max_ {0};
+		long double sum_ {0};
+
+		static size_t index_of(uint64_t value);
+		static uint64_t value_of(size_t index);
+
+	    public:
+		Histogram() : counts_((groups+1) * sub_buckets) {}
+
+		void record(uint64_t value);
+		void merge(const Histogram& other);
+		uint64_t percentile(double percentile) const;
+
+		inline uint64_t count() const { return total_; }
+		inline uint64_t min() const { return total_ ? min_ : 0; }
+		inline uint64_t max() const { return max_; }
+		inline double mean() const { return total_ ? static_cast<double>(sum_/total_) : 0; }
+	};
+
+	int run(int argc, char** argv);
+
+    }
+}
+
+#endif
@@ -0,0 +1,59 @@
+#include "ncw.hh"
+#include <ostream>
+
+namespace ncw {
+
+    Body::Body(std::string data) {
+	size_t size = data.size();
+	append(std::make_shared<const std::string>(std::move(data)), 0, size);
+    }
+
+    void Body::append(Buffer buffer, size_t offset, size_t size) {
+	if(size == 0) return;
+	// Consecutive ranges of the same buffer collapse into one segment.
+	if(!segments_.empty()) {
+	    auto& last = segments_.back();
+	    if(last.buffer == buffer && last.offset+last.size == offset) {
+		last.size += size;
+		size_ += size;
+		return;
+	    }
+	}
+	segments_.push_back(Segment{std::move(buffer), offset, size});
+	size_ += size;
+    }
+
+    void Body::clear() {
+	segments_.clear();
+	size_ = 0;
+    }
+
+    void Body::join() const {
+	auto joined = std::make_shared<std::string>();
+	joined->reserve(size_);
+	for(const auto& segment: segments_)
+	    joined->append(segment.view());
+	segments_.assign(1, Segment{std::move(joined), 0, size_});
+    }
+
+    std::string_view Body::view() const {
+	if(segments_.empty()) return {};
+	if(segments_.size() > 1) join();
+	return segments_.front().view();
+    }
+
+    const std::string& Body::string() const {
+	static const std::string empty {};
+	if(segments_.empty()) return empty;
+	const auto& front = segments_.front();
+	if(segments_.size() > 1 || front.offset != 0 || front.size != front.buffer->size()) join();
+	return *segments_.front().buffer;
+    }
+
+    std::ostream& operator<<(std::ostream& stream, const Body& body) {
+	for(const auto& segment: body.segments())
+	    stream << segment.view();
+	return stream;
+    }
+
+}
@@ -1,5 +1,8 @@
 #include "ncw.hh"
+#include "uring.hh"
+#include "trace.hh"
 #include <cerrno>
+#include <cstddef>
 #include <cstring>
 #include <new>
 #include <stdexcept>
@@ -7,35 +10,147 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/un.h>
 #include <poll.h>
 #include <fcntl.h>
+#include <unistd.h>
 #include <openssl/err.h>
 #include <openssl/ssl.h>
 
 namespace ncw {
     namespace inner {
 
+	static void set_option(int fd, int level, int name, int value) {
+	    // Options are hints: kernels without TFO or busy polling reject them
+	    // with ENOPROTOOPT/EPERM and the connection works without them.
+	    setsockopt(fd, level, name, &value, sizeof(value));
+	}
+
+	static void apply_socket_options(int fd, const SocketOptions& options, int family) {
+	    if(family == AF_UNIX) {
+		if(options.recv_buffer > 0) set_option(fd, SOL_SOCKET, SO_RCVBUF, options.recv_buffer);
+		if(options.send_buffer > 0) set_option(fd, SOL_SOCKET, SO_SNDBUF, options.send_buffer);
+		return;
+	    }
+	    if(options.tcp_nodelay) set_option(fd, IPPROTO_TCP, TCP_NODELAY, 1);
+	    if(options.tcp_quickack) set_option(fd, IPPROTO_TCP, TCP_QUICKACK, 1);
+#ifdef TCP_FASTOPEN_CONNECT
+	    if(options.tcp_fastopen) set_option(fd, IPPROTO_TCP, TCP_FASTOPEN_CONNECT, 1);
+#endif
+	    if(options.recv_buffer > 0) set_option(fd, SOL_SOCKET, SO_RCVBUF, options.recv_buffer);
+	    if(options.send_buffer > 0) set_option(fd, SOL_SOCKET, SO_SNDBUF, options.send_buffer);
+	    if(options.keepalive_idle > 0) {
+		set_option(fd, SOL_SOCKET, SO_KEEPALIVE, 1);
+		set_option(fd, IPPROTO_TCP, TCP_KEEPIDLE, options.keepalive_idle);
+		set_option(fd, IPPROTO_TCP, TCP_KEEPINTVL, options.keepalive_idle);
+	    }
+#ifdef SO_BUSY_POLL
+	    if(options.busy_poll > 0) set_option(fd, SOL_SOCKET, SO_BUSY_POLL, options.busy_poll);
+#endif
+	}
+
 	void Connection::connect_socket(const std::string& hostname, const std::string& port) {
+	    connect_socket(hostname, port, port == "443", false);
+	}
+
+	void Connection::connect_socket(const Url& url, bool allow_defer) {
+	    bool use_ssl = url.scheme == "https";
+	    if(!url.socket_path.empty()) return connect_unix(url.socket_path, false);
+	    if(!options.unix_socket.empty()) return connect_unix(options.unix_socket, use_ssl);
+	    bool defer = allow_defer && !use_ssl && options.io_backend == IoBackend::io_uring && Uring::local();
+	    connect_socket(url.hostname, url.port, use_ssl, defer);
+	}
+
+	void Connection::connect_now() {
+	    connect_socket(std::string{hostname}, std::string{port}, false, false);
+	}
+
+	// With defer set, the socket is only created here and the connect is
+	// submitted by io_uring together with the first request bytes.
+	void Connection::connect_socket(const std::string& hostname, const std::string& port, bool use_ssl, bool defer) {
+	    disconnect();
+	    this->hostname = hostname;
+	    this->port = port;
 	    struct addrinfo* info {nullptr};
 	    int result {0};
 	    struct addrinfo hints {
 		.ai_family = AF_UNSPEC,
 		.ai_socktype = SOCK_STREAM,
 	    };
-	    if((result = getaddrinfo(hostname.c_str(), port.c_str(), &hints, &info)) != 0)
+	    NCW_PROBE(dns_start, hostname.c_str(), port.c_str());
+	    trace::Span resolving {};
+	    result = getaddrinfo(hostname.c_str(), port.c_str(), &hints, &info);
+	    NCW_PROBE(dns_done, hostname.c_str(), result);
+	    resolving.end("dns", hostname);
+	    if(result != 0)
 		throw std::runtime_error(gai_strerror(result));
 
+	    NCW_PROBE(connect_start, hostname.c_str(), port.c_str());
+	    trace::Span connecting {};
 	    struct addrinfo* iter;
 	    for(iter = info; iter != nullptr; iter = iter->ai_next) {
-		if((fd = socket(info->ai_family, info->ai_socktype, info->ai_protocol)) == -1)
+		if((fd = socket(iter->ai_family, iter->ai_socktype, iter->ai_protocol)) == -1)
 		    continue;
-		if(connect(fd, info->ai_addr, info->ai_addrlen) == -1)
-		    throw std::runtime_error(strerror(errno));
+		apply_socket_options(fd, options, iter->ai_family);
+		if(defer && iter->ai_addrlen <= sizeof(pending_address)) {
+		    memcpy(&pending_address, iter->ai_addr, iter->ai_addrlen);
+		    pending_length = iter->ai_addrlen;
+		    pending_connect = true;
+		    break;
+		}
+		if(connect(fd, iter->ai_addr, iter->ai_addrlen) == -1) {
+		    result = errno;
+		    close(fd);
+		    fd = -1;
+		    continue;
+		}
 		break;
 	    }
-	    if(info == nullptr) throw std::runtime_error("Connection is null");
 	    freeaddrinfo(info);
-	    if(port == "443") init_openssl_connection();
+	    NCW_PROBE(connect_done, hostname.c_str(), iter ? fd : -1);
+	    connecting.end(defer ? "socket" : "connect", hostname);
+	    if(iter == nullptr) throw std::runtime_error(result ? strerror(result) : "Connection is null");
+	    if(use_ssl) {
+		if(!ssl_ctx) init_openssl_lib();
+		init_openssl_connection();
+	    }
+	}
+
+	void Connection::connect_unix(const std::string& path, bool use_ssl) {
+	    disconnect();
+	    this->hostname = path;
+	    this->port = {};
+	    sockaddr_un address {};
+	    if(path.size() >= sizeof(address.sun_path))
+		throw std::runtime_error("Unix socket path too long: " + path);
+	    address.sun_family = AF_UNIX;
+	    memcpy(address.sun_path, path.data(), path.size());
+	    socklen_t length = offsetof(sockaddr_un, sun_path) + path.size() + 1;
+	    if(path.front() == '@') {
+		address.sun_path[0] = '\0';
+		length--;
+	    }
+
+	    NCW_PROBE(connect_start, path.c_str(), "");
+	    trace::Span connecting {};
+	    if((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) == -1)
+		throw std::runtime_error(strerror(errno));
+	    apply_socket_options(fd, options, AF_UNIX);
+	    if(connect(fd, reinterpret_cast<const sockaddr*>(&address), length) == -1) {
+		int error = errno;
+		close(fd);
+		fd = 0;
+		throw std::runtime_error(path + ": " + strerror(error));
+	    }
+	    is_unix = true;
+	    NCW_PROBE(connect_done, path.c_str(), fd);
+	    connecting.end("connect", path);
+	    if(use_ssl) {
+		if(!ssl_ctx) init_openssl_lib();
+		init_openssl_connection();
+	    }
 	}
 
 	void Connection::handle_openssl_error() {
@@ -73,7 +188,11 @@ namespace ncw {
 	    ssl = SSL_new(ssl_ctx);
 	    handle_openssl_error();
 	    SSL_set_fd(ssl, this->fd);
-	    SSL_connect(ssl);
+	    NCW_PROBE(tls_start, hostname.c_str());
+	    trace::Span handshake {};
+	    [[maybe_unused]] int result = SSL_connect(ssl);
+	    NCW_PROBE(tls_done, hostname.c_str(), result);
+	    handshake.end("tls", hostname);
 	    handle_openssl_error();
 	    this->is_ssl = true;
 	}
@@ -89,8 +208,41 @@ namespace ncw {
 	    connect_socket(hostname, port);
 	}
 
+	void Connection::disconnect() {
+	    if(ssl) {
+		SSL_free(ssl);
+		ssl = nullptr;
+	    }
+	    is_ssl = false;
+	    is_unix = false;
+	    pending_connect = false;
+	    if(fd > 0) close(fd);
+	    fd = 0;
+	}
+
+	// An idle keep-alive socket should have nothing to read; readability
+	// means the peer closed it or sent something we cannot pair with a request.
+	bool Connection::is_alive() const {
+	    if(fd <= 0) return false;
+	    if(pending_connect) return true;
+	    struct pollfd pfd {fd, POLLIN, 0};
+	    if(poll(&pfd, 1, 0) != 0) return false;
+	    return true;
+	}
+
+	// TCP_QUICKACK is not sticky, the kernel may fall back to delayed ACKs
+	// after any read, so it is re-armed before every response.
+	void Connection::quickack() const {
+	    if(options.tcp_quickack && fd > 0 && !is_unix) set_option(fd, IPPROTO_TCP, TCP_QUICKACK, 1);
+	}
+
+	Uring* Connection::uring() const {
+	    if(is_ssl || fd <= 0 || options.io_backend != IoBackend::io_uring) return nullptr;
+	    return Uring::local();
+	}
+
 	Connection::~Connection() {
-	    if(ssl) SSL_free(ssl);
+	    disconnect();
 	    if(ssl_ctx) SSL_CTX_free(ssl_ctx);
 	}
 
@@ -0,0 +1,314 @@
+#include "ncw.hh"
+#include <algorithm>
+#include <cctype>
+#include <ctime>
+#include <fstream>
+#include <stdexcept>
+
+namespace ncw {
+
+    static constexpr size_t max_cached_headers {1024};
+
+    static std::string_view trim(std::string_view str) {
+	while(!str.empty() && std::isspace(static_cast<unsigned char>(str.front()))) str.remove_prefix(1);
+	while(!str.empty() && std::isspace(static_cast<unsigned char>(str.back()))) str.remove_suffix(1);
+	return str;
+    }
+
+    static std::string to_lower(std::string_view str) {
+	std::string lower {str};
+	for(auto& c: lower) c = std::tolower(static_cast<unsigned char>(c));
+	return lower;
+    }
+
+    static bool is_ip_address(const std::string& host) {
+	if(host.find(':') != std::string::npos) return true;
+	return std::all_of(host.begin(), host.end(), [](char c) { return std::isdigit(static_cast<unsigned char>(c)) || c == '.'; });
+    }
+
+    // Without a public suffix list, Domain= values are only screened for the
+    // obvious shared suffixes: single labels ("com") and ccTLD categories
+    // such as "co.uk" or "com.au". Names like "ibm.de" stay valid.
+    static bool public_suffix(const std::string& domain) {
+	size_t last = domain.rfind('.');
+	if(last == std::string::npos) return true;
+	size_t second = domain.rfind('.', last-1);
+	if(second != std::string::npos || domain.size()-last-1 != 2) return false;
+	static const std::vector<std::string> categories {"ac", "co", "com", "edu", "gob", "gov", "gv", "ltd", "me", "mil", "ne", "net", "nic", "nom", "or", "org", "plc", "sch"};
+	return std::find(categories.begin(), categories.end(), domain.substr(0, last)) != categories.end();
+    }
+
+    static bool domain_match(const std::string& host, const std::string& domain) {
+	if(host == domain) return true;
+	return host.size() > domain.size()
+	    && host.compare(host.size()-domain.size(), domain.size(), domain) == 0
+	    && host[host.size()-domain.size()-1] == '.'
+	    && !is_ip_address(host);
+    }
+
+    static bool path_match(std::string_view request_path, const std::string& cookie_path) {
+	if(request_path.compare(0, cookie_path.size(), cookie_path) != 0) return false;
+	return request_path.size() == cookie_path.size()
+	    || cookie_path.back() == '/'
+	    || request_path[cookie_path.size()] == '/';
+    }
+
+    static std::string_view request_path(const std::string& query) {
+	std::string_view path {query};
+	if(size_t pos = path.find_first_of("?#"); pos != std::string_view::npos) path = path.substr(0, pos);
+	if(path.empty() || path.front() != '/') return "/";
+	return path;
+    }
+
+    static std::string default_path(std::string_view path) {
+	size_t pos = path.rfind('/');
+	if(pos == 0 || pos == std::string_view::npos) return "/";
+	return std::string{path.substr(0, pos)};
+    }
+
+    static int64_t parse_http_date(const std::string& date) {
+	struct tm tm {};
+	for(const char* format: {"%a, %d %b %Y %H:%M:%S", "%a, %d-%b-%Y %H:%M:%S", "%a, %d-%b-%y %H:%M:%S"}) {
+	    tm = {};
+	    if(strptime(date.c_str(), format, &tm)) return timegm(&tm);
+	}
+	return -1;
+    }
+
+    static bool is_secure(const inner::Url& url) {
+	return url.scheme == "https";
+    }
+
+    void CookieJar::store(Cookie&& cookie) {
+	auto& bucket = cookies_[cookie.domain];
+	auto found = std::find_if(bucket.begin(), bucket.end(), [&](const Cookie& c) {
+	    return c.name == cookie.name && c.domain == cookie.domain && c.path == cookie.path;
+	});
+	bool expired = cookie.expires != 0 && cookie.expires <= std::time(nullptr);
+	if(!expired && cookie.expires && (!next_expiry_ || cookie.expires < next_expiry_)) next_expiry_ = cookie.expires;
+	if(found != bucket.end()) {
+	    if(expired) bucket.erase(found);
+	    else *found = std::move(cookie);
+	} else if(!expired) {
+	    bucket.push_back(std::move(cookie));
+	}
+	cache_.clear();
+    }
+
+    void CookieJar::expire(int64_t now) {
+	next_expiry_ = 0;
+	for(auto domain = cookies_.begin(); domain != cookies_.end();) {
+	    auto& bucket = domain->second;
+	    bucket.erase(std::remove_if(bucket.begin(), bucket.end(), [now](const Cookie& c) {
+		return c.expires && c.expires <= now;
+	    }), bucket.end());
+	    for(const auto& cookie: bucket)
+		if(cookie.expires && (!next_expiry_ || cookie.expires < next_expiry_)) next_expiry_ = cookie.expires;
+	    if(bucket.empty()) domain = cookies_.erase(domain);
+	    else domain++;
+	}
+	cache_.clear();
+    }
+
+    void CookieJar::parse(const std::string& set_cookie, const inner::Url& url) {
+	std::string host = to_lower(url.hostname);
+	size_t begin {0};
+	while(begin < set_cookie.size()) {
+	    size_t end = set_cookie.find('\n', begin);
+	    if(end == std::string::npos) end = set_cookie.size();
+	    std::string_view line {set_cookie.data()+begin, end-begin};
+	    begin = end+1;
+
+	    size_t semicolon = line.find(';');
+	    std::string_view pair = line.substr(0, semicolon);
+	    size_t eq = pair.find('=');
+	    if(eq == std::string_view::npos) continue;
+	    Cookie cookie {};
+	    cookie.name = trim(pair.substr(0, eq));
+	    cookie.value = trim(pair.substr(eq+1));
+	    if(cookie.name.empty()) continue;
+
+	    bool has_max_age {false};
+	    bool rejected {false};
+	    std::string_view attributes = semicolon == std::string_view::npos ? std::string_view{} : line.substr(semicolon+1);
+	    while(!attributes.empty()) {
+		size_t next = attributes.find(';');
+		std::string_view attribute = trim(attributes.substr(0, next));
+		attributes = next == std::string_view::npos ? std::string_view{} : attributes.substr(next+1);
+		size_t sep = attribute.find('=');
+		std::string key = to_lower(trim(attribute.substr(0, sep)));
+		std::string val {sep == std::string_view::npos ? std::string_view{} : trim(attribute.substr(sep+1))};
+
+		if(key == "max-age") {
+		    try {
+			long long age = std::stoll(val);
+			cookie.expires = age <= 0 ? 1 : std::time(nullptr) + age;
+			has_max_age = true;
+		    } catch(const std::exception&) {}
+		} else if(key == "expires" && !has_max_age) {
+		    int64_t expires = parse_http_date(val);
+		    if(expires > 0) cookie.expires = expires;
+		    else if(expires == 0) cookie.expires = 1;
+		} else if(key == "domain" && !val.empty()) {
+		    if(val.front() == '.') val.erase(0, 1);
+		    cookie.domain = to_lower(val);
+		    if(!domain_match(host, cookie.domain)) rejected = true;
+		    else if(public_suffix(cookie.domain)) {
+			// Only the suffix host itself may set it, as a host-only
+			// cookie (RFC 6265 5.3 step 5).
+			if(cookie.domain == host) cookie.domain.clear();
+			else rejected = true;
+		    }
+		} else if(key == "path" && !val.empty() && val.front() == '/') {
+		    cookie.path = val;
+		} else if(key == "secure") {
+		    cookie.secure = true;
+		} else if(key == "httponly") {
+		    cookie.http_only = true;
+		}
+	    }
+	    if(rejected) continue;
+	    if(cookie.domain.empty()) {
+		cookie.domain = host;
+		cookie.host_only = true;
+	    }
+	    if(cookie.path.empty()) cookie.path = default_path(request_path(url.query));
+	    store(std::move(cookie));
+	}
+    }
+
+    void CookieJar::add(const std::string& name, const std::string& value, const std::string& domain) {
+	Cookie cookie {};
+	cookie.name = name;
+	cookie.value = value;
+	cookie.domain = to_lower(domain);
+	cookie.path = "/";
+	store(std::move(cookie));
+    }
+
+    void CookieJar::clear() {
+	cookies_.clear();
+	cache_.clear();
+	next_expiry_ = 0;
+    }
+
+    const std::string& CookieJar::header(const inner::Url& url) {
+	int64_t now = std::time(nullptr);
+	if(next_expiry_ && now >= next_expiry_) expire(now);
+
+	bool secure = is_secure(url);
+	std::string_view path = request_path(url.query);
+	std::string key {};
+	key.reserve(url.hostname.size() + path.size() + 1);
+	key += secure ? '+' : '-';
+	key += url.hostname;
+	key += path;
+	if(auto cached = cache_.find(key); cached != cache_.end())
+	    return cached->second;
+
+	std::string host = to_lower(url.hostname);
+	std::vector<const Cookie*> matched {};
+	auto collect = [&](const std::vector<Cookie>& bucket) {
+	    for(const auto& cookie: bucket) {
+		if(cookie.secure && !secure) continue;
+		if(!cookie.domain.empty()) {
+		    if(cookie.host_only ? host != cookie.domain : !domain_match(host, cookie.domain)) continue;
+		}
+		if(!path_match(path, cookie.path)) continue;
+		matched.push_back(&cookie);
+	    }
+	};
+	// A cookie for domain d can only match hosts ending in d, so the host
+	// and each of its dot-suffixes name every bucket worth scanning.
+	if(auto any = cookies_.find(""); any != cookies_.end()) collect(any->second);
+	for(size_t begin = 0; begin != std::string::npos;) {
+	    if(auto domain = cookies_.find(host.substr(begin)); domain != cookies_.end()) collect(domain->second);
+	    if(is_ip_address(host)) break;
+	    begin = host.find('.', begin);
+	    if(begin != std::string::npos) begin++;
+	}
+	std::stable_sort(matched.begin(), matched.end(), [](const Cookie* a, const Cookie* b) {
+	    return a->path.size() > b->path.size();
+	});
+
+	std::string serialized {};
+	for(const auto* cookie: matched) {
+	    if(!serialized.empty()) serialized += "; ";
+	    serialized += cookie->name;
+	    serialized += '=';
+	    serialized += cookie->value;
+	}
+	if(cache_.size() >= max_cached_headers) cache_.clear();
+	return cache_.emplace(std::move(key), std::move(serialized)).first->second;
+    }
+
+    std::map<std::string, std::string> CookieJar::to_map() const {
+	std::map<std::string, std::string> map {};
+	for(const auto& domain: cookies_)
+	    for(const auto& cookie: domain.second)
+		map.insert_or_assign(cookie.name, cookie.value);
+	return map;
+    }
+
+    // Netscape cookies.txt layout, the same one curl and wget read and write:
+    // domain, include subdomains, path, secure, expiry, name, value.
+    void CookieJar::save(const std::string& path) const {
+	std::ofstream file {path, std::ios::trunc};
+	if(!file) throw std::runtime_error("Cannot open cookie file " + path);
+	int64_t now = std::time(nullptr);
+	file << "# Netscape HTTP Cookie File\n";
+	for(const auto& domain: cookies_) {
+	    for(const auto& cookie: domain.second) {
+		if(cookie.expires && cookie.expires <= now) continue;
+		file << (cookie.http_only ? "#HttpOnly_" : "") << cookie.domain << '\t'
+		    << (cookie.host_only ? "FALSE" : "TRUE") << '\t'
+		    << cookie.path << '\t'
+		    << (cookie.secure ? "TRUE" : "FALSE") << '\t'
+		    << cookie.expires << '\t'
+		    << cookie.name << '\t'
+		    << cookie.value << '\n';
+	    }
+	}
+	if(!file) throw std::runtime_error("Cannot write cookie file " + path);
+    }
+
+    void CookieJar::load(const std::string& path) {
+	std::ifstream file {path};
+	if(!file) throw std::runtime_error("Cannot open cookie file " + path);
+	std::string line {};
+	while(std::getline(file, line)) {
+	    bool http_only {false};
+	    if(line.rfind("#HttpOnly_", 0) == 0) {
+		http_only = true;
+		line.erase(0, 10);
+	    } else if(line.empty() || line.front() == '#') continue;
+
+	    std::vector<std::string> fields {};
+	    size_t begin {0};
+	    size_t tab {0};
+	    while((tab = line.find('\t', begin)) != std::string::npos && fields.size() < 6) {
+		fields.push_back(line.substr(begin, tab-begin));
+		begin = tab+1;
+	    }
+	    fields.push_back(line.substr(begin));
+	    if(fields.size() != 7) continue;
+
+	    Cookie cookie {};
+	    cookie.domain = to_lower(fields[0]);
+	    if(!cookie.domain.empty() && cookie.domain.front() == '.') cookie.domain.erase(0, 1);
+	    cookie.host_only = fields[1] != "TRUE";
+	    cookie.path = fields[2].empty() ? "/" : fields[2];
+	    cookie.secure = fields[3] == "TRUE";
+	    try {
+		cookie.expires = std::stoll(fields[4]);
+	    } catch(const std::exception&) {
+		continue;
+	    }
+	    cookie.name = fields[5];
+	    cookie.value = fields[6];
+	    cookie.http_only = http_only;
+	    store(std::move(cookie));
+	}
+    }
+
+}
@@ -1,9 +1,26 @@
 #include "ncw.hh"
+#include "bench.hh"
+#include <cstring>
 #include <iostream>
 
 int main(int argc, char** argv) {
+    if(argc >= 2 && strcmp(argv[1], "bench") == 0)
+	return ncw::bench::run(argc-1, argv+1);
+
+    if(argc >= 4 && strcmp(argv[1], "download") == 0) {
+	ncw::Session session {};
+	ncw::SocketOptions options {};
+	options.io_backend = ncw::IoBackend::io_uring;
+	session.set_socket_options(options);
+	auto response = session.download(argv[2], argv[3]);
+	std::cout << "HTTP Status code: " << response.status_code << std::endl;
+	return 0;
+    }
+
     if(argc < 3) {
 	std::cout << "Usage: " << argv[0] << " <method> <url>" << std::endl;
+	std::cout << "       " << argv[0] << " download <url> <file>" << std::endl;
+	std::cout << "       " << argv[0] << " bench [options] <url>" << std::endl;
 	std::cout << " Methods: GET, HEAD, POST, PUT, PATCH, DELETE, OPTIONS" << std::endl;
 	exit(1);
     }
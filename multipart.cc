@@ -0,0 +1,75 @@
+#include "ncw.hh"
+#include <cerrno>
+#include <cstring>
+#include <random>
+#include <stdexcept>
+#include <sys/stat.h>
+
+namespace ncw {
+
+    // Quotes and line breaks would end the parameter or the header line, so
+    // they are percent-encoded the way browsers do it.
+    static std::string escape(const std::string& value) {
+	std::string escaped {};
+	escaped.reserve(value.size());
+	for(char c: value) {
+	    if(c == '"') escaped += "%22";
+	    else if(c == '\r') escaped += "%0D";
+	    else if(c == '\n') escaped += "%0A";
+	    else escaped += c;
+	}
+	return escaped;
+    }
+
+    Multipart::Multipart() {
+	static constexpr char digits[] {"0123456789abcdef"};
+	std::random_device random {};
+	boundary_ = "ncw-boundary-";
+	for(int i = 0; i < 24; i++) boundary_ += digits[random() & 15];
+	closing_ = "--" + boundary_ + "--" + std::string(inner::http::newline);
+    }
+
+    Multipart::Part& Multipart::add_part(const std::string& name, const std::string& filename, const std::string& content_type) {
+	Part part {};
+	part.head = "--" + boundary_ + std::string(inner::http::newline);
+	part.head += "Content-Disposition: form-data; name=\"" + escape(name) + "\"";
+	if(!filename.empty()) part.head += "; filename=\"" + escape(filename) + "\"";
+	part.head += std::string(inner::http::newline);
+	if(!content_type.empty()) part.head += "Content-Type: " + content_type + std::string(inner::http::newline);
+	part.head += std::string(inner::http::newline);
+	parts_.push_back(std::move(part));
+	return parts_.back();
+    }
+
+    Multipart& Multipart::add(const std::string& name, const std::string& value) {
+	add_part(name, {}, {}).data = value;
+	return *this;
+    }
+
+    Multipart& Multipart::add_file(const std::string& name,
+	    const std::string& path,
+	    const std::string& content_type,
+	    const std::string& filename) {
+	std::string basename {filename};
+	if(basename.empty()) {
+	    size_t slash = path.rfind('/');
+	    basename = slash == std::string::npos ? path : path.substr(slash+1);
+	}
+	add_part(name, basename, content_type).path = path;
+	return *this;
+    }
+
+    Multipart& Multipart::add_fd(const std::string& name,
+	    int fd,
+	    const std::string& filename,
+	    const std::string& content_type) {
+	struct stat info {};
+	if(fstat(fd, &info) == -1)
+	    throw std::invalid_argument("Bad descriptor for part " + name + ": " + strerror(errno));
+	if(!S_ISREG(info.st_mode))
+	    throw std::invalid_argument("Descriptor for part " + name + " is not a regular file");
+	add_part(name, filename, content_type).fd = fd;
+	return *this;
+    }
+
+}
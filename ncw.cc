@@ -1,62 +1,159 @@
 #include "ncw.hh"
+#include "trace.hh"
+#include <cerrno>
 #include <cstdint>
+#include <cstring>
+#include <stdexcept>
 #include <sys/fcntl.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netdb.h>
 #include <poll.h>
 #include <fcntl.h>
+#include <unistd.h>
 #include <openssl/err.h>
 #include <openssl/ssl.h>
 
 namespace ncw {
 
-    static const Response request(inner::Url& parsed_url,
+    static void store_cookies(const Response& response, const inner::Url& url, CookieJar& cookies) {
+	if(auto header = response.headers.find("set-cookie"); header != response.headers.end())
+	    cookies.parse(header->second, url);
+    }
+
+    static bool is_redirect(uint16_t status_code) {
+	return status_code == 301 || status_code == 302 || status_code == 303
+	    || status_code == 307 || status_code == 308;
+    }
+
+    static bool is_idempotent(inner::Method method) {
+	return method != inner::Method::post && method != inner::Method::patch;
+    }
+
+    static Response perform(const inner::Url& url,
 	    const inner::Method method,
 	    const std::string& data,
 	    const std::map<std::string, std::string>& headers,
-	    const std::map<std::string, std::string>& cookies,
-	    inner::Connection& connection,
+	    CookieJar& cookies,
+	    inner::Pool& pool,
+	    Scheduler* scheduler,
+	    const int priority,
+	    const uint64_t timeout,
+	    const int sink,
+	    const Multipart* form,
+	    const ExpectContinue* expect) {
+	NCW_PROBE(request_start, url.url.c_str());
+	inner::trace::Span span {};
+	Scheduler::Ticket ticket {};
+	if(scheduler) {
+	    inner::trace::Span queued {};
+	    ticket = scheduler->acquire(url, priority);
+	    if(queued.active()) queued.end("queue", url.origin());
+	}
+	bool reused {false};
+	auto connection = pool.acquire(url, reused);
+	Response response {};
+	bool expected {false};
+	bool reusable {true};
+	auto attempt = [&](const ExpectContinue* expect) {
+	    inner::Request request {url, *connection, method, data, headers, cookies.header(url), timeout, sink, form, expect};
+	    response = request.perform();
+	    expected = request.expected();
+	    reusable = !request.body_skipped() && request.keep_alive();
+	};
+	try {
+	    attempt(expect);
+	} catch(const std::runtime_error&) {
+	    // A pooled connection may have been closed by the server while idle.
+	    if(!reused || !is_idempotent(method)) throw;
+	    // Downloads start at offset 0, so drop whatever the failed attempt wrote.
+	    if(sink >= 0 && (ftruncate(sink, 0) == -1 || lseek(sink, 0, SEEK_SET) == -1))
+		throw std::runtime_error(strerror(errno));
+	    connection = pool.acquire(url, reused = false);
+	    attempt(expect);
+	}
+	// Servers that refuse the expectation get the request again without it.
+	if(response.status_code == 417 && expected) {
+	    if(reusable) pool.release(url, std::move(connection));
+	    connection = pool.acquire(url, reused);
+	    attempt(nullptr);
+	}
+	store_cookies(response, url, cookies);
+	if(reusable) pool.release(url, std::move(connection));
+	NCW_PROBE(request_done, url.url.c_str(), response.status_code);
+	span.end("request", url.url);
+	return response;
+    }
+
+    static Response request(inner::Url& parsed_url,
+	    const inner::Method method,
+	    const std::string& data,
+	    const std::map<std::string, std::string>& headers,
+	    CookieJar& cookies,
+	    inner::Pool& pool,
+	    inner::RedirectCache* redirects,
+	    Scheduler* scheduler,
+	    const int priority,
 	    const bool follow_redirects,
-	    const uint64_t timeout) {
+	    const uint64_t timeout,
+	    const ExpectContinue* expect,
+	    const int sink = -1,
+	    const Multipart* form = nullptr) {
+	if(!follow_redirects)
+	    return perform(parsed_url, method, data, headers, cookies, pool, scheduler, priority, timeout, sink, form, expect);
 
-	if(follow_redirects) {
-	    Response inner_response {};
-	    bool redirect = false;
-	    std::string prev_port {};
-	    do {
-		inner_response = inner::Request{parsed_url, connection, method, data, headers, cookies, timeout}.perform();
-		if(inner_response.status_code >= 300 && inner_response.status_code <= 308) {
-		    if(auto location = inner_response.headers.find("location"); location != inner_response.headers.end()) {
-			prev_port = parsed_url.port;
-			parsed_url = inner::Url::parse(location->second);
-			if(parsed_url.port != prev_port)
-			    connection.connect_socket(parsed_url.hostname, parsed_url.port);
-			redirect = true;
-		    }
-		} else redirect = false;
-	    } while(redirect);
-	    return inner_response;
+	inner::Method current_method {method};
+	const std::string empty {};
+	const std::string* body {&data};
+	if(redirects) parsed_url = redirects->resolve(parsed_url, method);
+	for(uint8_t hops = 0;; hops++) {
+	    auto response = perform(parsed_url, current_method, *body, headers, cookies, pool, scheduler, priority, timeout, sink, form, expect);
+	    if(!is_redirect(response.status_code)) return response;
+	    auto location = response.headers.find("location");
+	    if(location == response.headers.end()) return response;
+	    if(hops >= inner::http::max_redirects) throw std::runtime_error("Too many redirects");
+
+	    auto target = parsed_url.resolve(location->second);
+	    // Only requests that already go to a local socket may be redirected
+	    // to one; a remote server must not reach docker.sock and the like.
+	    if(!target.socket_path.empty() && parsed_url.socket_path.empty()) return response;
+	    NCW_PROBE(redirect, response.status_code, parsed_url.url.c_str(), target.url.c_str());
+	    if(inner::trace::recording()) inner::trace::instant("redirect", parsed_url.url + " -> " + target.url);
+	    bool preserves_method = response.status_code == 307 || response.status_code == 308;
+	    if(redirects && (response.status_code == 301 || response.status_code == 308))
+		redirects->insert(parsed_url, target, preserves_method);
+	    if((response.status_code == 303 && current_method != inner::Method::head)
+		    || (!preserves_method && current_method == inner::Method::post)) {
+		current_method = inner::Method::get;
+		body = &empty;
+		form = nullptr;
+	    }
+	    parsed_url = std::move(target);
 	}
-	return inner::Request{parsed_url, connection, method, data, headers, cookies, timeout}.perform();
     }
 
-    static const Response single_request(const std::string& url,
+    static Response single_request(const std::string& url,
 	    const inner::Method method,
 	    const std::string& data,
 	    const std::map<std::string, std::string>& headers,
 	    const std::map<std::string, std::string>& cookies,
 	    const bool follow_redirects,
-	    const uint64_t timeout) {
-	inner::Connection connection{true};
+	    const uint64_t timeout,
+	    const Multipart* form = nullptr) {
+	inner::Pool pool {};
 	inner::Url parsed_url = inner::Url::parse(url);
-	connection.connect_socket(parsed_url.hostname, parsed_url.port);
+	CookieJar jar {};
+	for(const auto& cookie: cookies)
+	    jar.add(cookie.first, cookie.second);
+
+	auto scheduler = Scheduler::global();
+	ExpectContinue expect {};
 
-	return request(parsed_url, method, data, headers, cookies, connection, follow_redirects, timeout);
+	return request(parsed_url, method, data, headers, jar, pool, nullptr, scheduler.get(), 0, follow_redirects, timeout, &expect, -1, form);
     }
 
     namespace single {
-	const Response GET(const std::string& url,
+	Response GET(const std::string& url,
     	        const std::string& data,
     	        const std::map<std::string, std::string>& headers,
     	        const std::map<std::string, std::string>& cookies,
@@ -65,7 +162,7 @@ namespace ncw {
     	    return single_request(url, inner::Method::get, data, headers, cookies, follow_redirects, timeout);
     	}
 
-    	const Response HEAD(const std::string& url,
+    	Response HEAD(const std::string& url,
     	        const std::map<std::string, std::string>& headers,
     	        const std::map<std::string, std::string>& cookies,
     	        const bool follow_redirects,
@@ -73,7 +170,7 @@ namespace ncw {
     	    return single_request(url, inner::Method::head, {}, headers, cookies, follow_redirects, timeout);
     	}
 
-    	const Response POST(const std::string& url,
+    	Response POST(const std::string& url,
     	        const std::string& data,
     	        const std::map<std::string, std::string>& headers,
     	        const std::map<std::string, std::string>& cookies,
@@ -82,7 +179,7 @@ namespace ncw {
     	    return single_request(url, inner::Method::post, data, headers, cookies, follow_redirects, timeout);
     	}
 
-        const Response PUT(const std::string& url,
+        Response PUT(const std::string& url,
 		const std::string& data,
     	    	const std::map<std::string, std::string>& headers,
     	        const std::map<std::string, std::string>& cookies,
@@ -91,7 +188,7 @@ namespace ncw {
     	    return single_request(url, inner::Method::put, data, headers, cookies, follow_redirects, timeout);
 	}
 
-        const Response PATCH(const std::string& url,
+        Response PATCH(const std::string& url,
 		const std::string& data,
     	    	const std::map<std::string, std::string>& headers,
     	        const std::map<std::string, std::string>& cookies,
@@ -100,7 +197,7 @@ namespace ncw {
     	    return single_request(url, inner::Method::patch, data, headers, cookies, follow_redirects, timeout);
 	}
 
-        const Response DELETE(const std::string& url,
+        Response DELETE(const std::string& url,
 		const std::string& data,
     	    	const std::map<std::string, std::string>& headers,
     	        const std::map<std::string, std::string>& cookies,
@@ -109,56 +206,34 @@ namespace ncw {
 	    return single_request(url, inner::Method::delete_, data, headers, cookies, follow_redirects, timeout);
 	}
 
-        const Response OPTIONS(const std::string& url,
+        Response OPTIONS(const std::string& url,
 		const std::map<std::string, std::string>& headers,
     	        const std::map<std::string, std::string>& cookies,
     	    	const bool follow_redirects,
     	    	const uint64_t timeout) {
     	    return single_request(url, inner::Method::options, {}, headers, cookies, follow_redirects, timeout);
 	}
+
+        Response upload(const std::string& url,
+		const Multipart& form,
+		const std::map<std::string, std::string>& headers,
+    	        const std::map<std::string, std::string>& cookies,
+    	    	const bool follow_redirects,
+    	    	const uint64_t timeout) {
+    	    return single_request(url, inner::Method::post, {}, headers, cookies, follow_redirects, timeout, &form);
+	}
     }
 
 #define NCW_METHODS_SESSION_DEFINITION \
-auto p_url = inner::Url::parse(url); \
-if(p_url.hostname != url_.hostname || p_url.port != url_.port) { \
-    connection_.connect_socket(p_url.hostname, p_url.port); \
-    url_ = std::move(p_url); \
-} \
+url_ = inner::Url::parse(url); \
+auto scheduler = scheduler_ ? scheduler_ : Scheduler::global(); \
 if(!headers.empty()) headers_ = headers; \
-if(!cookies.empty()) cookies_ = cookies;
+if(!cookies.empty()) add_cookies(cookies);
 
 #define NCW_METHODS_SESSION_DEFINITION_DATA \
 if(!data.empty()) data_ = data;
 
-    static std::pair<std::string, std::string> split_str_by_char(const std::string& str, char delim) {
-	size_t sep {0};
-    	if((sep = str.find_first_of(delim)) != std::string::npos) {
-	    auto key = str.substr(0,sep);
-	    auto val = str.substr(sep+1);
-	    if(key == "Expires" || key == "Max-Age" || key == "Path" || key == "SameSite" || key == "Domain")
-		return std::make_pair("", "");
-	    return std::make_pair(key, val);
-	}
-	return std::make_pair("", "");
-    }
-
-    void Session::parse_cookies(const Response& response) {
-	if(response.headers.find("set-cookie") == response.headers.end()) return;
-	const std::string& cookies = response.headers.at("set-cookie");
-	size_t prev {0};
-	size_t next {0};
-	while((next = cookies.find("; ", prev)) != std::string::npos) {
-	    auto str = cookies.substr(prev, next-prev);
-	    auto [key, val] = split_str_by_char(str, '=');
-	    if(!key.empty()) cookies_[key] = val;
-	    prev = next+2;
-	}
-	auto str = cookies.substr(prev, next-prev);
-    	auto [key, val] = split_str_by_char(str, '=');
-	if(!key.empty()) cookies_[key] = val;
-    }
-
-    const Response Session::GET(const std::string& url,
+    Response Session::GET(const std::string& url,
 	    const std::string& data,
             const std::map<std::string, std::string>& headers,
             const std::map<std::string, std::string>& cookies,
@@ -166,23 +241,21 @@ if(!data.empty()) data_ = data;
             const uint64_t timeout) {
 	NCW_METHODS_SESSION_DEFINITION
 	NCW_METHODS_SESSION_DEFINITION_DATA
-        auto response = request(url_, inner::Method::get, data_, headers_, cookies_, connection_, follow_redirects_, timeout_);
-	parse_cookies(response);
+        auto response = request(url_, inner::Method::get, data_, headers_, cookies_, pool_, &redirects_, scheduler.get(), priority_, follow_redirects_, timeout_, &expect_);
 	return response;
     }
     
-    const Response Session::HEAD(const std::string& url,
+    Response Session::HEAD(const std::string& url,
             const std::map<std::string, std::string>& headers,
             const std::map<std::string, std::string>& cookies,
             const bool follow_redirects,
             const uint64_t timeout) {
 	NCW_METHODS_SESSION_DEFINITION
-        auto response = request(url_, inner::Method::head, data_, headers_, cookies_, connection_, follow_redirects_, timeout_);
-	parse_cookies(response);
+        auto response = request(url_, inner::Method::head, data_, headers_, cookies_, pool_, &redirects_, scheduler.get(), priority_, follow_redirects_, timeout_, &expect_);
 	return response;
     }
     
-    const Response Session::POST(const std::string& url,
+    Response Session::POST(const std::string& url,
             const std::string& data,
             const std::map<std::string, std::string>& headers,
             const std::map<std::string, std::string>& cookies,
@@ -190,12 +263,11 @@ if(!data.empty()) data_ = data;
             const uint64_t timeout) {
 	NCW_METHODS_SESSION_DEFINITION
 	NCW_METHODS_SESSION_DEFINITION_DATA
-        auto response = request(url_, inner::Method::post, data_, headers_, cookies_, connection_, follow_redirects_, timeout_);
-	parse_cookies(response);
+        auto response = request(url_, inner::Method::post, data_, headers_, cookies_, pool_, &redirects_, scheduler.get(), priority_, follow_redirects_, timeout_, &expect_);
 	return response;
     }
     
-    const Response Session::PUT(const std::string& url,
+    Response Session::PUT(const std::string& url,
     	    const std::string& data,
 	    const std::map<std::string, std::string>& headers,
             const std::map<std::string, std::string>& cookies,
@@ -203,12 +275,11 @@ if(!data.empty()) data_ = data;
 	    const uint64_t timeout) {
 	NCW_METHODS_SESSION_DEFINITION
 	NCW_METHODS_SESSION_DEFINITION_DATA
-        auto response = request(url_, inner::Method::put, data_, headers_, cookies_, connection_, follow_redirects_, timeout_);
-	parse_cookies(response);
+        auto response = request(url_, inner::Method::put, data_, headers_, cookies_, pool_, &redirects_, scheduler.get(), priority_, follow_redirects_, timeout_, &expect_);
 	return response;
     }
     
-    const Response Session::PATCH(const std::string& url,
+    Response Session::PATCH(const std::string& url,
 	    const std::string& data,
     	    const std::map<std::string, std::string>& headers,
             const std::map<std::string, std::string>& cookies,
@@ -216,12 +287,11 @@ if(!data.empty()) data_ = data;
 	    const uint64_t timeout) {
 	NCW_METHODS_SESSION_DEFINITION
 	NCW_METHODS_SESSION_DEFINITION_DATA
-        auto response = request(url_, inner::Method::patch, data_, headers_, cookies_, connection_, follow_redirects_, timeout_);
-	parse_cookies(response);
+        auto response = request(url_, inner::Method::patch, data_, headers_, cookies_, pool_, &redirects_, scheduler.get(), priority_, follow_redirects_, timeout_, &expect_);
 	return response;
     }
     
-    const Response Session::DELETE(const std::string& url,
+    Response Session::DELETE(const std::string& url,
 	    const std::string& data,
     	    const std::map<std::string, std::string>& headers,
             const std::map<std::string, std::string>& cookies,
@@ -229,20 +299,51 @@ if(!data.empty()) data_ = data;
 	    const uint64_t timeout) {
 	NCW_METHODS_SESSION_DEFINITION
 	NCW_METHODS_SESSION_DEFINITION_DATA
-        auto response = request(url_, inner::Method::delete_, data_, headers_, cookies_, connection_, follow_redirects_, timeout_);
-	parse_cookies(response);
+        auto response = request(url_, inner::Method::delete_, data_, headers_, cookies_, pool_, &redirects_, scheduler.get(), priority_, follow_redirects_, timeout_, &expect_);
 	return response;
     }
     
-    const Response Session::OPTIONS(const std::string& url,
+    Response Session::OPTIONS(const std::string& url,
 	    const std::map<std::string, std::string>& headers,
             const std::map<std::string, std::string>& cookies,
     	    const bool follow_redirects,
 	    const uint64_t timeout) {
 	NCW_METHODS_SESSION_DEFINITION
-        auto response = request(url_, inner::Method::options, data_, headers_, cookies_, connection_, follow_redirects_, timeout_);
-	parse_cookies(response);
+        auto response = request(url_, inner::Method::options, data_, headers_, cookies_, pool_, &redirects_, scheduler.get(), priority_, follow_redirects_, timeout_, &expect_);
 	return response;
     }
 
+    Response Session::upload(const std::string& url,
+	    const Multipart& form,
+	    const std::map<std::string, std::string>& headers,
+            const std::map<std::string, std::string>& cookies,
+    	    const bool follow_redirects,
+	    const uint64_t timeout) {
+	NCW_METHODS_SESSION_DEFINITION
+        auto response = request(url_, inner::Method::post, {}, headers_, cookies_, pool_, &redirects_, scheduler.get(), priority_, follow_redirects_, timeout_, &expect_, -1, &form);
+	return response;
+    }
+
+    size_t Session::preconnect(const std::vector<std::string>& urls, size_t connections, uint64_t refresh) {
+	std::vector<inner::Url> parsed {};
+	parsed.reserve(urls.size());
+	for(const auto& url: urls) parsed.push_back(inner::Url::parse(url));
+	return pool_.preconnect(parsed, connections, scheduler_ ? scheduler_ : Scheduler::global(), refresh);
+    }
+
+    Response Session::download(const std::string& url, const std::string& path) {
+	url_ = inner::Url::parse(url);
+	auto scheduler = scheduler_ ? scheduler_ : Scheduler::global();
+	int file = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if(file == -1) throw std::runtime_error(strerror(errno));
+	try {
+	    auto response = request(url_, inner::Method::get, {}, headers_, cookies_, pool_, &redirects_, scheduler.get(), priority_, follow_redirects_, timeout_, &expect_, file);
+	    close(file);
+	    return response;
+	} catch(...) {
+	    close(file);
+	    throw;
+	}
+    }
+
 }
@@ -1,20 +1,131 @@
 #ifndef NCW_H_
 #define NCW_H_
 
+#include <chrono>
+#include <condition_variable>
 #include <cstdint>
+#include <iosfwd>
 #include <string_view>
 #include <string>
+#include <list>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <sys/socket.h>
 #include <openssl/ssl.h>
 
 namespace ncw {
 
+    class Multipart;
+    class Scheduler;
+
+    // Response body kept as a chain of refcounted receive buffers. Copies and
+    // moves share the buffers. view() and the std::string conversion join a
+    // multi-segment chain into one buffer on first use and keep it, which is
+    // not synchronized: join before sharing a Body across threads.
+    class Body {
+	public:
+	    using Buffer = std::shared_ptr<const std::string>;
+
+	    struct Segment {
+		Buffer buffer;
+		size_t offset;
+		size_t size;
+
+		inline std::string_view view() const { return {buffer->data()+offset, size}; }
+	    };
+
+	    Body() = default;
+	    Body(std::string data);
+	    inline Body(const char* data) : Body{std::string{data}} {}
+
+	    void append(Buffer buffer, size_t offset, size_t size);
+	    void clear();
+
+	    inline const std::vector<Segment>& segments() const { return segments_; }
+	    inline size_t size() const { return size_; }
+	    inline bool empty() const { return size_ == 0; }
+
+	    std::string_view view() const;
+	    const std::string& string() const;
+	    inline operator const std::string&() const { return string(); }
+
+	    // Read-only std::string interface over string(), so code written
+	    // against the former std::string Response::data keeps compiling.
+	    static constexpr size_t npos {std::string::npos};
+	    inline const char* c_str() const { return string().c_str(); }
+	    inline const char* data() const { return string().data(); }
+	    inline size_t length() const { return size_; }
+	    inline char operator[](size_t pos) const { return string()[pos]; }
+	    inline char at(size_t pos) const { return string().at(pos); }
+	    inline char front() const { return string().front(); }
+	    inline char back() const { return string().back(); }
+	    inline std::string::const_iterator begin() const { return string().begin(); }
+	    inline std::string::const_iterator end() const { return string().end(); }
+	    inline std::string substr(size_t pos = 0, size_t count = npos) const { return string().substr(pos, count); }
+	    template <typename... Args> inline size_t find(Args&&... args) const { return string().find(std::forward<Args>(args)...); }
+	    template <typename... Args> inline size_t rfind(Args&&... args) const { return string().rfind(std::forward<Args>(args)...); }
+	    template <typename... Args> inline size_t find_first_of(Args&&... args) const { return string().find_first_of(std::forward<Args>(args)...); }
+	    template <typename... Args> inline size_t find_last_of(Args&&... args) const { return string().find_last_of(std::forward<Args>(args)...); }
+	    template <typename... Args> inline size_t find_first_not_of(Args&&... args) const { return string().find_first_not_of(std::forward<Args>(args)...); }
+	    template <typename... Args> inline size_t find_last_not_of(Args&&... args) const { return string().find_last_not_of(std::forward<Args>(args)...); }
+	    template <typename... Args> inline int compare(Args&&... args) const { return string().compare(std::forward<Args>(args)...); }
+
+	private:
+	    mutable std::vector<Segment> segments_ {};
+	    size_t size_ {0};
+
+	    void join() const;
+    };
+
+    std::ostream& operator<<(std::ostream& stream, const Body& body);
+    inline bool operator==(const Body& body, std::string_view data) { return body.view() == data; }
+    inline bool operator!=(const Body& body, std::string_view data) { return body.view() != data; }
+
     struct Response {
-	std::string data;
-	uint16_t status_code;
+	Body data;
+	uint16_t status_code {0};
 	std::map<std::string, std::string> headers;
     };
 
+    enum class IoBackend {
+	poll,
+	io_uring,
+    };
+
+    // Per-socket tuning applied before connect. Zero sizes keep kernel defaults.
+    // A non-zero keepalive_idle enables TCP keepalive probes after that many
+    // idle seconds, so dead peers of pooled connections get noticed.
+    // The io_uring backend covers plain HTTP only and falls back to poll when
+    // the kernel does not support it.
+    struct SocketOptions {
+	bool tcp_nodelay {true};
+	bool tcp_fastopen {false};
+	bool tcp_quickack {true};
+	int recv_buffer {0};
+	int send_buffer {0};
+	int busy_poll {0};
+	int keepalive_idle {0};
+	IoBackend io_backend {IoBackend::poll};
+	// Connect every request to this AF_UNIX stream socket instead of the
+	// URL's host, e.g. a local sidecar proxy. A leading '@' names an
+	// abstract socket.
+	std::string unix_socket {};
+    };
+
+    // Request bodies of at least threshold bytes are announced with
+    // Expect: 100-continue and held back until the server answers 100 or wait
+    // milliseconds pass. A final status that arrives first (401, 413, a
+    // redirect) is returned without the body ever being sent. A threshold of
+    // 0 disables it unless the request carries its own Expect header.
+    struct ExpectContinue {
+	uint64_t threshold {1 << 20};
+	int wait {1000};
+    };
+
     namespace inner {
 
         namespace http {
@@ -24,8 +135,16 @@ namespace ncw {
 	    constexpr std::string_view chunk_terminator{"0\r\n\r\n"};
 	    constexpr std::string_view prefix_http{"http://"};
 	    constexpr std::string_view prefix_https{"https://"};
+	    constexpr std::string_view prefix_http_unix{"http+unix://"};
 	    constexpr uint8_t def_timeout{2};
 	    constexpr uint16_t recv_offset{1024};
+	    constexpr size_t recv_buffer{16384};
+	    constexpr size_t max_header_size{1 << 20};
+	    constexpr uint8_t max_redirects{20};
+	    constexpr size_t redirect_cache_size{64};
+	    constexpr size_t max_idle_per_origin{4};
+	    constexpr size_t max_preconnect_threads{16};
+	    constexpr size_t upload_buffer{65536};
         }
 
 	enum class Method {
@@ -43,15 +162,28 @@ namespace ncw {
 	    std::string hostname;
 	    std::string port;
 	    std::string query;
+	    std::string scheme;
+	    std::string socket_path {};
 	    
 	    static Url parse(const std::string& url);
+	    Url resolve(const std::string& location) const;
+	    std::string origin() const;
 	};
 
+	class Uring;
+
 	struct Connection {
 	    int fd {0};
 	    bool is_ssl {false};
+	    bool is_unix {false};
 	    SSL* ssl {nullptr};
 	    SSL_CTX* ssl_ctx {nullptr};
+	    SocketOptions options {};
+	    std::string hostname {};
+	    std::string port {};
+	    bool pending_connect {false};
+	    sockaddr_storage pending_address {};
+	    socklen_t pending_length {0};
 
 	    Connection(bool init_openssl=false);
 	    Connection(const std::string& hostname,
@@ -63,31 +195,139 @@ namespace ncw {
 	    Connection& operator=(const Connection&) = delete;
 
 	    void connect_socket(const std::string& hostname, const std::string& port);
+	    void connect_socket(const Url& url, bool allow_defer = true);
+	    void connect_now();
+	    void disconnect();
+	    bool is_alive() const;
+	    Uring* uring() const;
+	    void quickack() const;
 	    bool is_openssl_error_retryable(int return_code);
 
 	    private:
 		void init_openssl_lib();
 		void init_openssl_connection();
 		void handle_openssl_error();
+		void connect_socket(const std::string& hostname, const std::string& port, bool use_ssl, bool defer);
+		void connect_unix(const std::string& path, bool use_ssl);
+	};
+
+	// Idle keep-alive connections keyed by origin. Connections that the peer
+	// closed, or that sat idle longer than the idle timeout, are dropped
+	// instead of being handed out. Origins warmed with a refresh interval are
+	// topped up by a background thread, so the state lives on the heap behind
+	// a mutex and the pool stays movable.
+	class Pool {
+	    private:
+		using clock = std::chrono::steady_clock;
+
+		struct Idle {
+		    std::unique_ptr<Connection> connection;
+		    clock::time_point since;
+		};
+
+		struct Warm {
+		    Url url;
+		    size_t count;
+		};
+
+		struct State {
+		    std::mutex mutex {};
+		    std::condition_variable wake {};
+		    std::map<std::string, std::vector<Idle>> idle {};
+		    std::map<std::string, Warm> warm {};
+		    std::shared_ptr<Scheduler> scheduler {};
+		    std::thread refresher {};
+		    uint64_t refresh {0};
+		    bool stopping {false};
+		    size_t max_idle_per_origin {http::max_idle_per_origin};
+		    uint64_t idle_timeout {0};
+		    SocketOptions options {};
+		};
+
+		std::unique_ptr<State> state_;
+
+		static bool usable(const State& state, const Idle& idle, clock::time_point now);
+		static size_t limit(const State& state, const std::string& origin);
+		static void prune(State& state);
+		static std::unique_ptr<Connection> open(const SocketOptions& options, const Url& url, bool allow_defer);
+		static size_t top_up(State& state, const std::vector<Warm>& targets, Scheduler* scheduler);
+		static void refresh_loop(State& state);
+		void stop_refresh();
+
+	    public:
+		Pool(size_t max_idle_per_origin = http::max_idle_per_origin);
+		~Pool();
+		Pool(Pool&& other) noexcept = default;
+		Pool& operator=(Pool&& other) noexcept;
+
+		inline const SocketOptions& get_options() const { return state_->options; }
+		void set_options(const SocketOptions& options);
+		void set_idle_timeout(uint64_t seconds);
+
+		std::unique_ptr<Connection> acquire(const Url& url, bool& reused);
+		void release(const Url& url, std::unique_ptr<Connection> connection);
+		size_t preconnect(const std::vector<Url>& urls, size_t count,
+			std::shared_ptr<Scheduler> scheduler = {}, uint64_t refresh = 0);
+		void prune();
+		void clear();
+	};
+
+	// Bounded LRU of permanent (301/308) redirects.
+	class RedirectCache {
+	    private:
+		struct Entry {
+		    std::string from;
+		    Url to;
+		    bool preserves_method;
+		};
+		size_t capacity_ {http::redirect_cache_size};
+		std::list<Entry> entries_ {};
+		std::map<std::string, std::list<Entry>::iterator> index_ {};
+
+	    public:
+		inline RedirectCache(size_t capacity = http::redirect_cache_size)
+		    : capacity_{capacity} {}
+
+		void insert(const Url& from, const Url& to, bool preserves_method);
+		Url resolve(const Url& url, Method method);
+		inline void clear() { entries_.clear(); index_.clear(); }
 	};
 
 	class Request {
     	    private:
     	        const Method method_;
     	        const uint64_t timeout_;
+		int sink_;
+		const Multipart* form_;
+		const ExpectContinue* expect_;
     	        const std::string& data_;
     	        const std::map<std::string, std::string>& headers_;
-    	        const std::map<std::string, std::string>& cookies_;
+    	        const std::string& cookies_;
 		Connection& connection_;
 		const Url& url_;
+		std::shared_ptr<std::string> buffer_ {};
+		size_t position_ {0};
+		size_t filled_ {0};
+		size_t header_end_ {0};
+		bool expecting_ {false};
+		bool body_skipped_ {false};
+		bool keep_alive_ {false};
 
-		void send_all(const std::string& data);
+		void send_all(const std::string_view* parts, size_t count);
+		inline void send_all(std::initializer_list<std::string_view> parts) { send_all(parts.begin(), parts.size()); }
+		void send_file(int fd, off_t offset, uint64_t length);
+		void send_form(std::string& message);
 		void send_request();
+		bool expect_continue(std::string& message, uint64_t length);
+		bool await_continue(const std::string& message);
 		Response read_response();
-		std::string recv_until_terminator(std::string terminator);
-		std::string get_data_in_chunks(const std::string& response);
-		std::string get_data_with_content_length(const std::string& response, const std::string& length);
-		std::pair<std::map<std::string, std::string>, uint16_t> parse_headers_status(std::string response);
+		size_t recv_headers();
+		void fill();
+		void consume(Body& body, size_t size);
+		std::string read_line();
+		void read_with_content_length(Body& body, uint64_t length);
+		void read_chunks(Body& body);
+		std::pair<std::map<std::string, std::string>, uint16_t> parse_headers_status(std::string_view response);
     	    
     	    public:
     	        inline Request(const Url& url,
@@ -95,53 +335,221 @@ namespace ncw {
 			const Method method = Method::get,
 			const std::string& data = {},
 			const std::map<std::string, std::string>& headers = {},
-			const std::map<std::string, std::string>& cookies = {},
-			const uint64_t timeout = http::def_timeout)
+			const std::string& cookies = {},
+			const uint64_t timeout = http::def_timeout,
+			const int sink = -1,
+			const Multipart* form = nullptr,
+			const ExpectContinue* expect = nullptr)
 		    : url_{url}, connection_{connection},
 		    method_{method}, data_{data}, headers_{headers},
-		    cookies_{cookies}, timeout_{timeout} {}
+		    cookies_{cookies}, timeout_{timeout}, sink_{sink}, form_{form}, expect_{expect} {}
 
     	        Response perform();
+		inline bool expected() const { return expecting_; }
+		// The server answered before the body went out, so the connection
+		// is left mid-request and must not be reused.
+		inline bool body_skipped() const { return body_skipped_; }
+		// The response leaves the connection open for another request.
+		inline bool keep_alive() const { return keep_alive_; }
     	};
     }
 
+    struct Cookie {
+	std::string name;
+	std::string value;
+	std::string domain;
+	std::string path;
+	int64_t expires {0};
+	bool host_only {false};
+	bool secure {false};
+	bool http_only {false};
+    };
+
+    // Cookies indexed by their Domain. Cookies added without a domain
+    // are sent to every host. Expired entries are dropped lazily, and the
+    // serialized Cookie header is cached per (host, path) until the jar changes.
+    class CookieJar {
+	private:
+	    std::map<std::string, std::vector<Cookie>> cookies_ {};
+	    std::map<std::string, std::string> cache_ {};
+	    int64_t next_expiry_ {0};
+
+	    void store(Cookie&& cookie);
+	    void expire(int64_t now);
+
+	public:
+	    void parse(const std::string& set_cookie, const inner::Url& url);
+	    void add(const std::string& name, const std::string& value, const std::string& domain = {});
+	    void clear();
+
+	    const std::string& header(const inner::Url& url);
+	    std::map<std::string, std::string> to_map() const;
+
+	    void save(const std::string& path) const;
+	    void load(const std::string& path);
+    };
+
+    // multipart/form-data body. File parts are referenced by path or
+    // descriptor and only opened when the request is sent: Content-Length is
+    // taken from their sizes and the contents are streamed to the socket, with
+    // sendfile on plain connections and a fixed buffer over TLS. Paths and
+    // descriptors must name regular files. Descriptor parts are sent from
+    // their current offset, which is left untouched.
+    class Multipart {
+	public:
+	    struct Part {
+		std::string head;
+		std::string data;
+		std::string path;
+		int fd {-1};
+	    };
+
+	    Multipart();
+
+	    Multipart& add(const std::string& name, const std::string& value);
+	    Multipart& add_file(const std::string& name,
+		    const std::string& path,
+		    const std::string& content_type = "application/octet-stream",
+		    const std::string& filename = {});
+	    Multipart& add_fd(const std::string& name,
+		    int fd,
+		    const std::string& filename,
+		    const std::string& content_type = "application/octet-stream");
+
+	    inline const std::vector<Part>& parts() const { return parts_; }
+	    inline const std::string& closing() const { return closing_; }
+	    inline std::string content_type() const { return "multipart/form-data; boundary=" + boundary_; }
+
+	private:
+	    std::string boundary_ {};
+	    std::string closing_ {};
+	    std::vector<Part> parts_ {};
+
+	    Part& add_part(const std::string& name, const std::string& filename, const std::string& content_type);
+    };
+
+    // Admission control shared by any number of sessions and threads. Requests
+    // beyond the global or per-origin in-flight limits wait in per-origin
+    // priority queues; freed slots go to origins in deficit round-robin order
+    // by weight, optionally throttled by a per-origin token bucket. Every
+    // in-flight request holds exactly one connection, so the limits also cap
+    // active connections.
+    class Scheduler {
+	public:
+	    class Ticket {
+		private:
+		    Scheduler* scheduler_ {nullptr};
+		    std::string origin_ {};
+
+		public:
+		    Ticket() = default;
+		    inline Ticket(Scheduler* scheduler, std::string origin)
+			: scheduler_{scheduler}, origin_{std::move(origin)} {}
+		    ~Ticket();
+		    Ticket(const Ticket&) = delete;
+		    Ticket& operator=(const Ticket&) = delete;
+		    Ticket(Ticket&& other) noexcept;
+		    Ticket& operator=(Ticket&& other) noexcept;
+	    };
+
+	    inline Scheduler(size_t max_in_flight = 64, size_t max_per_origin = 8)
+		: max_in_flight_{max_in_flight}, max_per_origin_{max_per_origin} {}
+
+	    void set_weight(const std::string& url, unsigned weight);
+	    void set_rate_limit(const std::string& url, double rate, double burst = 1);
+	    Ticket acquire(const inner::Url& url, int priority = 0);
+
+	    static std::shared_ptr<Scheduler> global();
+	    static void set_global(std::shared_ptr<Scheduler> scheduler);
+
+	private:
+	    using clock = std::chrono::steady_clock;
+
+	    struct Waiter {
+		bool granted {false};
+		std::condition_variable cv {};
+	    };
+
+	    struct Origin {
+		size_t in_flight {0};
+		unsigned weight {1};
+		double deficit {0};
+		double rate {0};
+		double burst {1};
+		double tokens {1};
+		clock::time_point refilled {};
+		bool active {false};
+		std::map<std::pair<int, uint64_t>, Waiter*> queue {};
+	    };
+
+	    std::mutex mutex_ {};
+	    std::map<std::string, Origin> origins_ {};
+	    std::list<Origin*> active_ {};
+	    std::list<Origin*>::iterator cursor_ {active_.end()};
+	    size_t max_in_flight_;
+	    size_t max_per_origin_;
+	    size_t in_flight_ {0};
+	    uint64_t sequence_ {0};
+
+	    bool eligible(Origin& origin, clock::time_point now);
+	    void dispatch(clock::time_point now);
+	    void release(const std::string& origin);
+    };
+
+    // In-process recorder of request phases (DNS, connect, TLS handshake,
+    // request write, time to first byte, body, redirects) saved as Chrome
+    // trace-event JSON for Perfetto or chrome://tracing. While stopped every
+    // phase costs one relaxed atomic load.
+    namespace trace {
+	void start();
+	void stop();
+	void clear();
+	void save(const std::string& path);
+    }
+
 #define NCW_METHODS_DECLARATION \
-const Response GET(const std::string& url, \
+Response GET(const std::string& url, \
     const std::string& data = {}, \
     const std::map<std::string, std::string>& headers = {}, \
     const std::map<std::string, std::string>& cookies = {}, \
     const bool follow_redirects = true, \
     const uint64_t timeout = inner::http::def_timeout); \
-const Response HEAD(const std::string& url, \
+Response HEAD(const std::string& url, \
     const std::map<std::string, std::string>& headers = {}, \
     const std::map<std::string, std::string>& cookies = {}, \
     const bool follow_redirects = true, \
     const uint64_t timeout = inner::http::def_timeout); \
-const Response POST(const std::string& url, \
+Response POST(const std::string& url, \
     const std::string& data = {}, \
     const std::map<std::string, std::string>& headers = {}, \
     const std::map<std::string, std::string>& cookies = {}, \
     const bool follow_redirects = true, \
     const uint64_t timeout = inner::http::def_timeout); \
-const Response PUT(const std::string& url, \
+Response PUT(const std::string& url, \
     const std::string& data = {}, \
     const std::map<std::string, std::string>& headers = {}, \
     const std::map<std::string, std::string>& cookies = {}, \
     const bool follow_redirects = true, \
     const uint64_t timeout = inner::http::def_timeout); \
-const Response PATCH(const std::string& url, \
+Response PATCH(const std::string& url, \
     const std::string& data = {}, \
     const std::map<std::string, std::string>& headers = {}, \
     const std::map<std::string, std::string>& cookies = {}, \
     const bool follow_redirects = true, \
     const uint64_t timeout = inner::http::def_timeout); \
-const Response DELETE(const std::string& url, \
+Response DELETE(const std::string& url, \
     const std::string& data = {}, \
     const std::map<std::string, std::string>& headers = {}, \
     const std::map<std::string, std::string>& cookies = {}, \
     const bool follow_redirects = true, \
     const uint64_t timeout = inner::http::def_timeout); \
-const Response OPTIONS(const std::string& url, \
+Response OPTIONS(const std::string& url, \
+    const std::map<std::string, std::string>& headers = {}, \
+    const std::map<std::string, std::string>& cookies = {}, \
+    const bool follow_redirects = true, \
+    const uint64_t timeout = inner::http::def_timeout); \
+Response upload(const std::string& url, \
+    const Multipart& form, \
     const std::map<std::string, std::string>& headers = {}, \
     const std::map<std::string, std::string>& cookies = {}, \
     const bool follow_redirects = true, \
@@ -158,10 +566,12 @@ const Response OPTIONS(const std::string& url, \
 	    inner::Url url_ {};
 	    std::string data_ {};
     	    std::map<std::string, std::string> headers_ {};
-	    std::map<std::string, std::string> cookies_ {};
-	    inner::Connection connection_ {true};
-
-	    void parse_cookies(const Response& response);
+	    CookieJar cookies_ {};
+	    inner::Pool pool_ {};
+	    inner::RedirectCache redirects_ {};
+	    std::shared_ptr<Scheduler> scheduler_ {};
+	    int priority_ {0};
+	    ExpectContinue expect_ {};
 
 	public:
 	    inline Session(std::string data = {},
@@ -169,25 +579,43 @@ const Response OPTIONS(const std::string& url, \
 		    std::map<std::string, std::string> cookies = {},
 		    uint64_t timeout = inner::http::def_timeout,
 		    bool follow_redirects = true)
-		: data_{data}, headers_{headers}, cookies_{cookies},
-		timeout_{timeout}, follow_redirects_{follow_redirects} {}
+		: data_{data}, headers_{headers},
+		timeout_{timeout}, follow_redirects_{follow_redirects} { add_cookies(cookies); }
 	    ~Session() = default;
 
-	    inline const std::map<std::string, std::string>& get_cookies() const { return cookies_; }
+	    inline std::map<std::string, std::string> get_cookies() const { return cookies_.to_map(); }
+	    inline CookieJar& get_cookie_jar() { return cookies_; }
+	    inline const SocketOptions& get_socket_options() const { return pool_.get_options(); }
+	    inline void set_socket_options(const SocketOptions& options) { pool_.set_options(options); }
+	    inline void set_scheduler(std::shared_ptr<Scheduler> scheduler, int priority = 0) { scheduler_ = std::move(scheduler); priority_ = priority; }
+	    inline void set_idle_timeout(uint64_t seconds) { pool_.set_idle_timeout(seconds); }
+	    inline void set_expect_continue(const ExpectContinue& expect) { expect_ = expect; }
+
+	    // Resolves, connects and TLS-handshakes up to connections idle
+	    // connections per origin in parallel, within the scheduler's limits,
+	    // and parks them in the pool. Returns how many were opened.
+	    // Servers close idle keep-alive connections on their own timeout.
+	    // With refresh set, a background thread re-checks these origins every
+	    // refresh seconds and replaces connections that were closed or passed
+	    // the idle timeout; without it, call preconnect again to top up.
+	    size_t preconnect(const std::vector<std::string>& urls, size_t connections = 1, uint64_t refresh = 0);
 
 	    inline void set_data(std::string data) { data_ = data; }
 	    inline void set_headers(std::map<std::string, std::string> headers) { headers_ = headers; }
-	    inline void set_cookies(std::map<std::string, std::string> cookies) { cookies_ = cookies; }
+	    inline void set_cookies(std::map<std::string, std::string> cookies) { cookies_.clear(); add_cookies(cookies); }
 
 	    inline void clear_data() { data_.clear(); }
 	    inline void clear_header() { headers_.clear(); }
 	    inline void clear_cookie() { cookies_.clear(); }
 
 	    inline void add_headers(std::map<std::string, std::string> headers) { for(auto& header: headers) headers_.insert_or_assign(header.first, header.second); }
-	    inline void add_cookies(std::map<std::string, std::string> cookies) { for(auto& cookie: cookies) cookies_.insert_or_assign(cookie.first, cookie.second); }
+	    inline void add_cookies(std::map<std::string, std::string> cookies) { for(auto& cookie: cookies) cookies_.add(cookie.first, cookie.second); }
 
 
 	    NCW_METHODS_DECLARATION
+
+	    // GET whose 2xx body is written to path instead of Response::data.
+	    Response download(const std::string& url, const std::string& path);
     };
 
 }
@@ -0,0 +1,237 @@
+#include "ncw.hh"
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+namespace ncw {
+    namespace inner {
+
+	Pool::Pool(size_t max_idle_per_origin) : state_{std::make_unique<State>()} {
+	    state_->max_idle_per_origin = max_idle_per_origin;
+	}
+
+	Pool::~Pool() {
+	    stop_refresh();
+	}
+
+	Pool& Pool::operator=(Pool&& other) noexcept {
+	    if(this != &other) {
+		stop_refresh();
+		state_ = std::move(other.state_);
+	    }
+	    return *this;
+	}
+
+	void Pool::stop_refresh() {
+	    if(!state_ || !state_->refresher.joinable()) return;
+	    {
+		std::lock_guard<std::mutex> lock {state_->mutex};
+		state_->stopping = true;
+	    }
+	    state_->wake.notify_all();
+	    state_->refresher.join();
+	    state_->stopping = false;
+	}
+
+	bool Pool::usable(const State& state, const Idle& idle, clock::time_point now) {
+	    if(state.idle_timeout && now-idle.since >= std::chrono::seconds(state.idle_timeout)) return false;
+	    return idle.connection->is_alive();
+	}
+
+	// Warmed origins may keep more idle connections than the default cap.
+	size_t Pool::limit(const State& state, const std::string& origin) {
+	    auto warm = state.warm.find(origin);
+	    if(warm == state.warm.end()) return state.max_idle_per_origin;
+	    return std::max(state.max_idle_per_origin, warm->second.count);
+	}
+
+	void Pool::prune(State& state) {
+	    auto now = clock::now();
+	    for(auto origin = state.idle.begin(); origin != state.idle.end();) {
+		auto& connections = origin->second;
+		connections.erase(std::remove_if(connections.begin(), connections.end(), [&](const Idle& idle) {
+		    return !usable(state, idle, now);
+		}), connections.end());
+		if(connections.empty()) origin = state.idle.erase(origin);
+		else origin++;
+	    }
+	}
+
+	std::unique_ptr<Connection> Pool::open(const SocketOptions& options, const Url& url, bool allow_defer) {
+	    auto connection = std::make_unique<Connection>(url.scheme == "https");
+	    connection->options = options;
+	    connection->connect_socket(url, allow_defer);
+	    return connection;
+	}
+
+	void Pool::set_options(const SocketOptions& options) {
+	    std::lock_guard<std::mutex> lock {state_->mutex};
+	    state_->options = options;
+	    state_->idle.clear();
+	}
+
+	void Pool::set_idle_timeout(uint64_t seconds) {
+	    std::lock_guard<std::mutex> lock {state_->mutex};
+	    state_->idle_timeout = seconds;
+	}
+
+	std::unique_ptr<Connection> Pool::acquire(const Url& url, bool& reused) {
+	    std::unique_lock<std::mutex> lock {state_->mutex};
+	    if(auto origin = state_->idle.find(url.origin()); origin != state_->idle.end()) {
+		auto& connections = origin->second;
+		auto now = clock::now();
+		while(!connections.empty()) {
+		    auto idle = std::move(connections.back());
+		    connections.pop_back();
+		    if(usable(*state_, idle, now)) {
+			reused = true;
+			return std::move(idle.connection);
+		    }
+		}
+	    }
+	    SocketOptions options {state_->options};
+	    lock.unlock();
+	    reused = false;
+	    return open(options, url, true);
+	}
+
+	void Pool::release(const Url& url, std::unique_ptr<Connection> connection) {
+	    if(!connection || connection->fd <= 0) return;
+	    auto origin = url.origin();
+	    std::lock_guard<std::mutex> lock {state_->mutex};
+	    auto& connections = state_->idle[origin];
+	    if(connections.size() >= limit(*state_, origin)) return;
+	    connections.push_back(Idle{std::move(connection), clock::now()});
+	}
+
+	void Pool::prune() {
+	    std::lock_guard<std::mutex> lock {state_->mutex};
+	    prune(*state_);
+	}
+
+	void Pool::clear() {
+	    stop_refresh();
+	    std::lock_guard<std::mutex> lock {state_->mutex};
+	    state_->idle.clear();
+	    state_->warm.clear();
+	}
+
+	// Connections are opened on worker threads without holding the lock,
+	// each under a scheduler ticket so warm-up respects the per-origin
+	// limits. Failed connects are skipped: warming up is best effort and the
+	// request path reports the real error later.
+	size_t Pool::top_up(State& state, const std::vector<Warm>& targets, Scheduler* scheduler) {
+	    std::vector<const Warm*> jobs {};
+	    SocketOptions options {};
+	    {
+		std::lock_guard<std::mutex> lock {state.mutex};
+		prune(state);
+		std::map<std::string, size_t> planned {};
+		for(const auto& target: targets) {
+		    auto origin = target.url.origin();
+		    auto [total, inserted] = planned.try_emplace(origin, 0);
+		    if(inserted) {
+			auto idle = state.idle.find(origin);
+			total->second = idle == state.idle.end() ? 0 : idle->second.size();
+		    }
+		    for(; total->second < target.count; total->second++) jobs.push_back(&target);
+		}
+		options = state.options;
+	    }
+	    if(jobs.empty()) return 0;
+
+	    std::vector<std::unique_ptr<Connection>> opened(jobs.size());
+	    std::atomic<size_t> next {0};
+	    auto work = [&]() {
+		for(size_t job; (job = next++) < jobs.size();) {
+		    try {
+			Scheduler::Ticket ticket {};
+			if(scheduler) ticket = scheduler->acquire(jobs[job]->url);
+			opened[job] = open(options, jobs[job]->url, false);
+		    } catch(const std::exception&) {}
+		}
+	    };
+	    std::vector<std::thread> workers {};
+	    size_t threads = std::min(jobs.size(), http::max_preconnect_threads);
+	    for(size_t i = 1; i < threads; i++) workers.emplace_back(work);
+	    work();
+	    for(auto& worker: workers) worker.join();
+
+	    size_t connected {0};
+	    std::lock_guard<std::mutex> lock {state.mutex};
+	    for(size_t job = 0; job < jobs.size(); job++) {
+		if(!opened[job]) continue;
+		auto origin = jobs[job]->url.origin();
+		auto& connections = state.idle[origin];
+		if(connections.size() >= std::max(limit(state, origin), jobs[job]->count)) continue;
+		connections.push_back(Idle{std::move(opened[job]), clock::now()});
+		connected++;
+	    }
+	    return connected;
+	}
+
+	void Pool::refresh_loop(State& state) {
+	    std::unique_lock<std::mutex> lock {state.mutex};
+	    for(;;) {
+		state.wake.wait_for(lock, std::chrono::seconds(state.refresh), [&]() { return state.stopping; });
+		if(state.stopping) return;
+		std::vector<Warm> targets {};
+		for(const auto& warm: state.warm) targets.push_back(warm.second);
+		auto scheduler = state.scheduler;
+		lock.unlock();
+		top_up(state, targets, scheduler.get());
+		lock.lock();
+	    }
+	}
+
+	// The count applies to this call only; with refresh set the origins are
+	// also registered for the background top-up.
+	size_t Pool::preconnect(const std::vector<Url>& urls, size_t count,
+		std::shared_ptr<Scheduler> scheduler, uint64_t refresh) {
+	    std::vector<Warm> targets {};
+	    targets.reserve(urls.size());
+	    for(const auto& url: urls) targets.push_back(Warm{url, count});
+	    if(refresh) {
+		{
+		    std::lock_guard<std::mutex> lock {state_->mutex};
+		    for(const auto& target: targets) state_->warm.insert_or_assign(target.url.origin(), target);
+		    state_->scheduler = scheduler;
+		    state_->refresh = refresh;
+		}
+		if(!state_->refresher.joinable())
+		    state_->refresher = std::thread{refresh_loop, std::ref(*state_)};
+	    }
+	    return top_up(*state_, targets, scheduler.get());
+	}
+
+	void RedirectCache::insert(const Url& from, const Url& to, bool preserves_method) {
+	    std::string key {from.origin() + from.query};
+	    if(auto found = index_.find(key); found != index_.end()) {
+		entries_.erase(found->second);
+		index_.erase(found);
+	    }
+	    entries_.push_front(Entry{key, to, preserves_method});
+	    index_[key] = entries_.begin();
+	    if(entries_.size() > capacity_) {
+		index_.erase(entries_.back().from);
+		entries_.pop_back();
+	    }
+	}
+
+	Url RedirectCache::resolve(const Url& url, Method method) {
+	    Url target {url};
+	    bool safe {method == Method::get || method == Method::head};
+	    for(uint8_t hops = 0; hops < http::max_redirects; hops++) {
+		auto found = index_.find(target.origin() + target.query);
+		if(found == index_.end()) break;
+		if(!found->second->preserves_method && !safe) break;
+		entries_.splice(entries_.begin(), entries_, found->second);
+		target = found->second->to;
+	    }
+	    return target;
+	}
+
+    }
+}
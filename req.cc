@@ -1,18 +1,26 @@
 #include "ncw.hh"
+#include "uring.hh"
+#include "trace.hh"
 #include <algorithm>
 #include <cassert>
 #include <cerrno>
 #include <cstdint>
 #include <cstring>
+#include <strings.h>
 #include <iterator>
 #include <stdexcept>
 #include <sys/fcntl.h>
 #include <vector>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
 #include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <poll.h>
 #include <fcntl.h>
+#include <unistd.h>
 #include <openssl/err.h>
 #include <openssl/ssl.h>
 
@@ -34,278 +42,515 @@ namespace ncw {
 		case Method::delete_:   return "DELETE"; break;
 		case Method::options:   return "OPTIONS"; break;
 	    }
+	    return {};
 	}
 
-	void Request::send_all(const std::string& data) {
-	    size_t total {0};
-	    size_t size {data.size()};
-	    size_t left {size};
-	    size_t ret {0};
-	    while(total < size) {
-		if(!connection_.is_ssl)
-		    ret = send(connection_.fd, data.data()+total, left, 0);
-		else {
-		    ret = SSL_write(connection_.ssl, data.data()+total, left);
-		    connection_.is_openssl_error_retryable(ret);
-		}
-		if(ret == -1) throw std::runtime_error(strerror(errno));
-		total += ret;
-		left -= ret;
-	    }
+	static int poll_event(int fd, int timeout, short event) {
+	    struct pollfd pfd[1];
+	    pfd[0].fd = fd;
+	    pfd[0].events = event;
+	    int ret = poll(pfd, 1, timeout*1000);
+	    if(ret == 0) throw std::runtime_error("Polling timeout"); //timeout
+	    else if(ret == -1) throw std::runtime_error(strerror(errno));
+	    return pfd[0].revents & event;
 	}
 
-	void Request::send_request() {
-	    std::string message;
-	    message += parse_method(method_) + " " + url_.query + " HTTP/1.1" + std::string(http::newline);
-	    message += "Host: " + url_.hostname + std::string(http::newline);
-	    message += "User-Agent: " + std::string(http::user_agent) + std::string(http::newline);
+	static uint16_t get_status_code(std::string_view line) {
+	    size_t st {0};
+	    if((st = line.find_first_of(' ')) == std::string_view::npos) return 0;
+	    return std::stoi(std::string{line.substr(st)});
+	}
 
-	    if(!headers_.empty())
-		for(const auto& header: headers_)
-		    message += header.first + ": " + header.second + std::string(http::newline);
+	// Connection is a comma-separated token list compared case-insensitively.
+	static bool has_token(std::string_view list, std::string_view token) {
+	    while(!list.empty()) {
+		size_t comma = list.find(',');
+		auto item = list.substr(0, comma);
+		while(!item.empty() && (item.front() == ' ' || item.front() == '\t')) item.remove_prefix(1);
+		while(!item.empty() && (item.back() == ' ' || item.back() == '\t')) item.remove_suffix(1);
+		if(item.size() == token.size() && strncasecmp(item.data(), token.data(), token.size()) == 0) return true;
+		list = comma == std::string_view::npos ? std::string_view{} : list.substr(comma+1);
+	    }
+	    return false;
+	}
 
-	    if(!cookies_.empty()) {
-		message += "Cookie: ";
-		for(const auto& cookie: cookies_)
-		    message += cookie.first + "=" + cookie.second + "; ";
-		message.erase(message.find_last_of(';'));
-		message += std::string(http::newline);
+	void Request::send_all(const std::string_view* parts, size_t count) {
+	    size_t bytes {0};
+	    for(size_t i = 0; i < count; i++) bytes += parts[i].size();
+	    NCW_PROBE(write_start, connection_.fd, bytes);
+	    trace::Span writing {};
+	    if(auto* ring = connection_.uring()) {
+		bool sent {false};
+		if(connection_.pending_connect) {
+		    connection_.pending_connect = false;
+		    sent = ring->connect_send(connection_.fd, reinterpret_cast<const sockaddr*>(&connection_.pending_address),
+			    connection_.pending_length, parts, count);
+		    // The linked connect only tries the first resolved address.
+		    if(!sent) connection_.connect_now();
+		}
+		if(!sent) ring->send(connection_.fd, parts, count);
+	    } else {
+		for(size_t i = 0; i < count; i++) {
+		    const auto& data = parts[i];
+		    size_t total {0};
+		    size_t size {data.size()};
+		    size_t left {size};
+		    size_t ret {0};
+		    while(total < size) {
+			if(!connection_.is_ssl)
+			    ret = send(connection_.fd, data.data()+total, left, MSG_NOSIGNAL);
+			else {
+			    ret = SSL_write(connection_.ssl, data.data()+total, left);
+			    connection_.is_openssl_error_retryable(ret);
+			}
+			if(ret == -1) throw std::runtime_error(strerror(errno));
+			total += ret;
+			left -= ret;
+		    }
+		}
 	    }
+	    NCW_PROBE(write_done, connection_.fd, bytes);
+	    writing.end("write", url_.hostname);
+	}
 
-	    if(method_ != Method::head && method_ != Method::delete_ && method_ != Method::options && !data_.empty()) {
-		message += "Content-Length: " + std::to_string(data_.size()) + std::string(http::terminator);
-		message += data_ + std::string(http::newline);
+	static void set_cork(const Connection& connection, int value) {
+	    if(!connection.is_ssl && !connection.is_unix) setsockopt(connection.fd, IPPROTO_TCP, TCP_CORK, &value, sizeof(value));
+	}
+
+	void Request::send_file(int fd, off_t offset, uint64_t length) {
+	    if(!connection_.is_ssl) {
+		NCW_PROBE(write_start, connection_.fd, length);
+		trace::Span writing {};
+		[[maybe_unused]] uint64_t total {length};
+		while(length > 0) {
+		    ssize_t sent = sendfile(connection_.fd, fd, &offset, std::min<uint64_t>(length, 1 << 30));
+		    if(sent == -1) {
+			if(errno == EINTR) continue;
+			if(errno == EAGAIN) {
+			    poll_event(connection_.fd, timeout_, POLLOUT);
+			    continue;
+			}
+			throw std::runtime_error(strerror(errno));
+		    }
+		    if(sent == 0) throw std::runtime_error("Upload file shrank while sending");
+		    length -= sent;
+		}
+		NCW_PROBE(write_done, connection_.fd, total);
+		writing.end("write file", url_.hostname);
+		return;
 	    }
-	    message += std::string(http::newline);
+	    std::vector<char> buffer(std::min<uint64_t>(length, http::upload_buffer));
+	    while(length > 0) {
+		ssize_t got = pread(fd, buffer.data(), std::min<uint64_t>(length, buffer.size()), offset);
+		if(got == -1) {
+		    if(errno == EINTR) continue;
+		    throw std::runtime_error(strerror(errno));
+		}
+		if(got == 0) throw std::runtime_error("Upload file shrank while sending");
+		send_all({std::string_view{buffer.data(), static_cast<size_t>(got)}});
+		offset += got;
+		length -= got;
+	    }
+	}
+
+	// Files are opened and sized before anything is written so that
+	// Content-Length is exact; part headers and string values are batched
+	// into as few sends as possible around each file.
+	void Request::send_form(std::string& message) {
+	    struct Source {
+		int fd {-1};
+		bool owned {false};
+		off_t offset {0};
+		uint64_t length {0};
+	    };
+	    const auto& parts = form_->parts();
+	    std::vector<Source> sources(parts.size());
+	    auto close_sources = [&]() {
+		for(auto& source: sources)
+		    if(source.owned) close(source.fd);
+	    };
+	    try {
+		uint64_t length {form_->closing().size()};
+		for(size_t i = 0; i < parts.size(); i++) {
+		    auto& source = sources[i];
+		    const auto& part = parts[i];
+		    length += part.head.size() + http::newline.size();
+		    if(!part.path.empty()) {
+			source.fd = open(part.path.c_str(), O_RDONLY | O_CLOEXEC | O_NONBLOCK);
+			if(source.fd == -1) throw std::runtime_error("Cannot open " + part.path + ": " + strerror(errno));
+			source.owned = true;
+		    } else if(part.fd >= 0) {
+			source.fd = part.fd;
+			source.offset = std::max<off_t>(lseek(part.fd, 0, SEEK_CUR), 0);
+		    } else {
+			length += part.data.size();
+			continue;
+		    }
+		    struct stat info {};
+		    if(fstat(source.fd, &info) == -1) throw std::runtime_error(strerror(errno));
+		    // Pipes and sockets have no size to announce and cannot be read with pread.
+		    if(!S_ISREG(info.st_mode))
+			throw std::runtime_error("Multipart part " + (part.path.empty() ? "descriptor" : part.path) + " is not a regular file");
+		    source.length = info.st_size > source.offset ? info.st_size - source.offset : 0;
+		    length += source.length;
+		}
+		expect_continue(message, length);
+		message += "Content-Type: " + form_->content_type() + std::string(http::newline);
+		message += "Content-Length: " + std::to_string(length) + std::string(http::terminator);
 #ifdef NCW_DEBUG
-	    std::cout << message << std::endl;
+		std::cout << message << std::endl;
 #endif
-	    send_all(message);
-	}
+		if(expecting_ && !await_continue(message)) {
+		    close_sources();
+		    return;
+		}
 
-	static int poll_event(int fd, int timeout, short event) {
-	    struct pollfd pfd[1];
-	    pfd[0].fd = fd;
-	    pfd[0].events = event;
-	    int ret = poll(pfd, 1, timeout*1000);
-	    if(ret == 0) throw std::runtime_error("Polling timeout"); //timeout
-	    else if(ret == -1) throw std::runtime_error(strerror(errno));
-	    return pfd[0].revents & event;
+		set_cork(connection_, 1);
+		std::vector<std::string_view> pending {};
+		if(!expecting_) pending.push_back(message);
+		for(size_t i = 0; i < parts.size(); i++) {
+		    pending.push_back(parts[i].head);
+		    if(sources[i].fd >= 0) {
+			send_all(pending.data(), pending.size());
+			pending.clear();
+			send_file(sources[i].fd, sources[i].offset, sources[i].length);
+		    } else pending.push_back(parts[i].data);
+		    pending.push_back(http::newline);
+		}
+		pending.push_back(form_->closing());
+		send_all(pending.data(), pending.size());
+		set_cork(connection_, 0);
+	    } catch(...) {
+		close_sources();
+		throw;
+	    }
+	    close_sources();
 	}
 
-	static bool find_string_in_vector(const std::vector<char>& haystack, const std::string& needle) {
-	    const char* n = needle.c_str();
-	    bool found = std::search(haystack.begin(), haystack.end(), n, n+strlen(n)) != haystack.end();
-	    return found;
+	bool Request::expect_continue(std::string& message, uint64_t length) {
+	    if(!expect_) return false;
+	    bool requested {false};
+	    for(const auto& header: headers_)
+		if(strcasecmp(header.first.c_str(), "expect") == 0)
+		    requested = strcasecmp(header.second.c_str(), "100-continue") == 0;
+	    expecting_ = requested || (expect_->threshold && length >= expect_->threshold);
+	    if(expecting_) message += "Expect: 100-continue" + std::string(http::newline);
+	    return expecting_;
 	}
 
-	static int recv_nb(Connection& connection, std::vector<char>& buffer, size_t size, int timeout) {
-	    int recvd {0};
-	    if(poll_event(connection.fd, timeout, POLLIN)) {
-		if(!connection.is_ssl) {
-		    if((recvd = recv(connection.fd, &buffer[0], size, 0)) == 0) {
-		        throw std::runtime_error("Peer closed connection");
-		    } else if(recvd == -1) {
-		        if(errno == EWOULDBLOCK) recvd = size;
-		        else throw std::runtime_error(strerror(errno));
-		    }
-		} else {
-		    if((recvd = SSL_read(connection.ssl, &buffer[0], size)) <= 0) {
-		        connection.is_openssl_error_retryable(recvd);
-			recvd = -1;
+	// Sends the headers alone and gives the server a bounded time to judge
+	// them. 100 Continue or silence releases the body; a final status stays
+	// buffered for read_response and the body is never sent.
+	bool Request::await_continue(const std::string& message) {
+	    send_all({message});
+	    trace::Span waiting {};
+	    uint16_t status {0};
+	    for(;;) {
+		bool buffered = position_ < filled_ || (connection_.is_ssl && SSL_pending(connection_.ssl) > 0);
+		if(!buffered) {
+		    if(auto* ring = connection_.uring()) {
+			if(!ring->wait_recv(connection_.fd, expect_->wait)) break;
+		    } else {
+			struct pollfd pfd {connection_.fd, POLLIN, 0};
+			int ready = poll(&pfd, 1, expect_->wait);
+			if(ready == -1) throw std::runtime_error(strerror(errno));
+			if(ready == 0) break;
 		    }
 		}
+		header_end_ = recv_headers();
+		status = get_status_code(std::string_view{buffer_->data(), header_end_});
+		if(status == 100) break;
+		// Other interim responses such as 103 Early Hints carry no verdict.
+		if(status > 100 && status < 200 && status != 101) continue;
+		body_skipped_ = true;
+		break;
 	    }
-	    return recvd;
+	    NCW_PROBE(expect_done, connection_.fd, status);
+	    waiting.end("expect", url_.hostname);
+	    return !body_skipped_;
 	}
 
-	static int recv_b(Connection& connection, std::vector<char>& buffer, size_t size, int timeout) {
+	void Request::send_request() {
+	    std::string message;
+	    message += parse_method(method_) + " " + url_.query + " HTTP/1.1" + std::string(http::newline);
+	    message += "Host: " + url_.hostname;
+	    // Explicit ports are part of the virtual host (RFC 9110 7.2).
+	    if(url_.socket_path.empty() && url_.port != (url_.scheme == "https" ? "443" : "80")) message += ":" + url_.port;
+	    message += std::string(http::newline);
+	    message += "User-Agent: " + std::string(http::user_agent) + std::string(http::newline);
+
+	    if(!headers_.empty())
+		for(const auto& header: headers_) {
+		    if(form_ && strcasecmp(header.first.c_str(), "content-type") == 0) continue;
+		    if(strcasecmp(header.first.c_str(), "expect") == 0) continue;
+		    message += header.first + ": " + header.second + std::string(http::newline);
+		}
+
+	    if(!cookies_.empty())
+		message += "Cookie: " + cookies_ + std::string(http::newline);
+
+	    if(form_) return send_form(message);
+
+	    bool has_body = method_ != Method::head && method_ != Method::delete_ && method_ != Method::options && !data_.empty();
+	    if(has_body) {
+		expect_continue(message, data_.size());
+		message += "Content-Length: " + std::to_string(data_.size()) + std::string(http::terminator);
+	    } else message += std::string(http::newline);
+#ifdef NCW_DEBUG
+	    std::cout << message << std::endl;
+#endif
+	    if(!has_body) send_all({message});
+	    else if(!expecting_) send_all({message, data_});
+	    else if(await_continue(message)) send_all({data_});
+	}
+
+	static int recv_b(Connection& connection, char* buffer, size_t size, int timeout) {
+	    if(auto* ring = connection.uring()) return ring->recv(connection.fd, buffer, size, timeout);
 	    int recvd {0};
-	    if(poll_event(connection.fd, timeout, POLLIN)) {
+	    // Bytes already decrypted by OpenSSL never show up in poll.
+	    if((connection.is_ssl && SSL_pending(connection.ssl) > 0) || poll_event(connection.fd, timeout, POLLIN)) {
 		if(!connection.is_ssl) {
-	    	    if((recvd = recv(connection.fd, &buffer[0], size, 0)) == 0)
+	    	    if((recvd = recv(connection.fd, buffer, size, 0)) == 0)
 	    	        throw std::runtime_error("Peer closed connection");
 	    	    else if(recvd == -1)
 	    	        throw std::runtime_error(strerror(errno));
 	    	} else {
-	    	    if((recvd = SSL_read(connection.ssl, &buffer[0], size)) <= 0)
+	    	    if((recvd = SSL_read(connection.ssl, buffer, size)) <= 0)
 	    		connection.is_openssl_error_retryable(recvd);
 	    	}
 	    }
 	    return recvd;
 	}
 
-	std::string Request::recv_until_terminator(std::string terminator) {
-	    std::vector<char> buffer(http::recv_offset);
-	    fcntl(connection_.fd, F_SETFL, O_NONBLOCK);
-	    if(connection_.is_ssl) SSL_set_fd(connection_.ssl, connection_.fd);
-	    std::vector<char> tmp_buffer(http::recv_offset);
-	    do {
-		int recvd = recv_nb(connection_, tmp_buffer, http::recv_offset, timeout_);
-		if(recvd == 0 || recvd == -1) continue;
-		buffer.insert(buffer.end(), std::begin(tmp_buffer), std::end(tmp_buffer));
-	    } while(!find_string_in_vector(tmp_buffer, terminator));
-	    const int flags = fcntl(connection_.fd, F_GETFL, 0);
-	    fcntl(connection_.fd, F_SETFL, flags^O_NONBLOCK);
-	    if(connection_.is_ssl) SSL_set_fd(connection_.ssl, connection_.fd);
-	    return std::string(buffer.begin(), buffer.end());
+	static void write_all(int fd, const char* data, size_t size) {
+	    while(size > 0) {
+		ssize_t written = write(fd, data, size);
+		if(written == -1) {
+		    if(errno == EINTR) continue;
+		    throw std::runtime_error(strerror(errno));
+		}
+		data += written;
+		size -= written;
+	    }
 	}
 
-	static uint16_t get_status_code(std::string line) {
-	    size_t st {0};
-	    if((st = line.find_first_of(' ')) == std::string::npos) return 0;
-	    return std::stoi(line.substr(st));
+	// Reads until the end of the header block. Body bytes that arrive with
+	// the headers stay in buffer_ after position_, and bytes left behind an
+	// interim 1xx response are kept for the next header block.
+	size_t Request::recv_headers() {
+	    if(!buffer_) {
+		buffer_ = std::make_shared<std::string>(http::recv_buffer, '\0');
+		filled_ = 0;
+	    } else {
+		memmove(buffer_->data(), buffer_->data()+position_, filled_-position_);
+		filled_ -= position_;
+	    }
+	    position_ = 0;
+	    size_t searched {0};
+	    trace::Span waiting {};
+	    for(;;) {
+		if(filled_ >= http::terminator.size()) {
+		    size_t end = std::string_view{buffer_->data(), filled_}.find(http::terminator, searched);
+		    if(end != std::string_view::npos) {
+			position_ = end+http::terminator.size();
+			return end;
+		    }
+		    searched = filled_-http::terminator.size()+1;
+		}
+		if(filled_ == buffer_->size()) {
+		    if(filled_ >= http::max_header_size) throw std::runtime_error("Response headers too large");
+		    buffer_->resize(filled_*2);
+		}
+		int recvd = recv_b(connection_, buffer_->data()+filled_, buffer_->size()-filled_, timeout_);
+		if(recvd <= 0) continue;
+		if(filled_ == 0) {
+		    NCW_PROBE(first_byte, connection_.fd);
+		    waiting.end("wait", url_.hostname);
+		}
+		filled_ += recvd;
+	    }
+	}
+
+	// Receives more data once buffer_ is consumed, reusing the buffer unless
+	// body segments still hold it.
+	void Request::fill() {
+	    while(position_ == filled_) {
+		if(buffer_.use_count() != 1) buffer_ = std::make_shared<std::string>(http::recv_buffer, '\0');
+		position_ = filled_ = 0;
+		int recvd = recv_b(connection_, buffer_->data(), buffer_->size(), timeout_);
+		if(recvd > 0) filled_ = recvd;
+	    }
+	}
+
+	void Request::consume(Body& body, size_t size) {
+	    if(sink_ >= 0) write_all(sink_, buffer_->data()+position_, size);
+	    else body.append(buffer_, position_, size);
+	    position_ += size;
 	}
 
-	std::pair<std::map<std::string, std::string>, uint16_t> Request::parse_headers_status(std::string response) {
+	std::string Request::read_line() {
+	    std::string line {};
+	    for(;;) {
+		fill();
+		const char* begin = buffer_->data()+position_;
+		const char* end = static_cast<const char*>(memchr(begin, '\n', filled_-position_));
+		size_t size = end ? end-begin : filled_-position_;
+		if(line.size()+size > http::max_header_size) throw std::runtime_error("Malformed chunked body");
+		line.append(begin, size);
+		position_ += size;
+		if(!end) continue;
+		position_++;
+		if(!line.empty() && line.back() == '\r') line.pop_back();
+		return line;
+	    }
+	}
+
+	std::pair<std::map<std::string, std::string>, uint16_t> Request::parse_headers_status(std::string_view response) {
 	    std::map<std::string, std::string> headers;
-	    uint16_t status_code;
+	    uint16_t status_code {0};
 	    size_t nl{0};
 	    size_t nnl{0};
-	    size_t len{0};
-	    while((nnl = response.find(http::newline, nl)) != std::string::npos) {
+	    while((nnl = response.find(http::newline, nl)) != std::string_view::npos || nl < response.size()) {
+		if(nnl == std::string_view::npos) nnl = response.size();
 		size_t len {nnl-nl};
 		if(len == 0) break;
 		auto line = response.substr(nl, len);
 		size_t sep{0};
-		if((sep = line.find(':')) != std::string::npos) {
-		    std::string key = line.substr(0,sep);
-		    std::string val = line.substr(sep+2);
+		if((sep = line.find(':')) != std::string_view::npos) {
+		    std::string key {line.substr(0,sep)};
+		    auto value = line.substr(sep+1);
+		    while(!value.empty() && value.front() == ' ') value.remove_prefix(1);
+		    std::string val {value};
 		    for(auto& c : key) c = std::tolower(c);
 		    if(key == "set-cookie")
 			if(headers.find("set-cookie") != headers.end())
-			    val += "; " + headers.at("set-cookie");
-		    headers[key] = val;
+			    val = headers.at("set-cookie") + "\n" + val;
+		    headers[key] = std::move(val);
 		} else 
 		    status_code = get_status_code(line);
 		nl = nnl+2;
 	    };
-	    return std::make_pair(headers, status_code);
+	    return std::make_pair(std::move(headers), status_code);
 	}
 
-	std::string Request::get_data_with_content_length(const std::string& response, const std::string& length) {
-	    long long content_length = std::stoi(length);
-	    size_t pos = response.find(http::terminator);
-	    assert(pos != std::string::npos);
-	    std::string data = response.substr(pos+4);
-	    data.shrink_to_fit();
-	    long long remaining = content_length - data.size();
-#ifdef NCW_DEBUG
-	    std::cout << data.size() << "/" << remaining << std::endl;
-#endif
-	    if(remaining <= 0) return data;
-	    std::vector<char> buffer(remaining);
-	    int recvd = recv_b(connection_, buffer, remaining, timeout_);
-	    data += std::string(buffer.begin(), buffer.end());
-#ifdef NCW_DEBUG
-	    data.shrink_to_fit();
-	    std::cout << data.size() << "/" << content_length << std::endl;
-	    std::cout << data << std::endl;
-#endif
-	    return data;
-	}
-
-	static std::pair<std::string, bool> read_all_from_buf(const std::string& response) {
-	    size_t pos = response.find(http::terminator);
-	    assert(pos != std::string::npos);
-	    std::string data = response.substr(pos+4);
-	    size_t end{};
-	    long long size;
-	    try {
-		size = std::stoll(data, &end, 16);
-	    	end += 2;
-	    } catch(std::invalid_argument const& e) {
-		return std::make_pair(data, false);
+	// In memory the body becomes a single buffer: bytes that came with the
+	// headers are copied once into a buffer sized from Content-Length and the
+	// rest is received straight into it.
+	void Request::read_with_content_length(Body& body, uint64_t length) {
+	    size_t buffered = std::min<uint64_t>(filled_-position_, length);
+	    if(sink_ >= 0) {
+		consume(body, buffered);
+		uint64_t remaining = length-buffered;
+		if(remaining == 0) return;
+		if(auto* ring = connection_.uring()) {
+		    ring->recv_to_file(connection_.fd, sink_, buffered, remaining, timeout_);
+		    return;
+		}
+		while(remaining > 0) {
+		    fill();
+		    size_t size = std::min<uint64_t>(remaining, filled_-position_);
+		    consume(body, size);
+		    remaining -= size;
+		}
+		return;
 	    }
-	    size_t next = data.find(http::newline);
-	    long long len = next-end;
-	    if(size-len <= 0 || len <= 0) {
-		size_t terminator = data.find(http::chunk_terminator);
-		if(terminator == std::string::npos) return std::make_pair(data, false);
-		return std::make_pair(data.substr(end, size-len), true);
+	    if(buffered == length) return consume(body, length);
+	    auto data = std::make_shared<std::string>(length, '\0');
+	    memcpy(data->data(), buffer_->data()+position_, buffered);
+	    position_ += buffered;
+	    uint64_t received {buffered};
+	    while(received < length) {
+		int recvd = recv_b(connection_, data->data()+received, length-received, timeout_);
+		if(recvd > 0) received += recvd;
 	    }
-	    return std::make_pair(data, false);
+	    body.append(std::move(data), 0, length);
 	}
 
-	static std::string parse_chunks(std::string& data) {
-	    size_t pos {0};
-	    std::string string{};
-	    while((pos = data.find(http::newline)) != std::string::npos) {
-		std::string in_str = data.substr(0, pos);
-		try {
-		    std::stoll(in_str, nullptr, 16);
-		} catch(std::invalid_argument const& e) {
-		    string += in_str;
+	// Chunk payloads are referenced in place in the receive buffers; only
+	// the size lines are copied out.
+	void Request::read_chunks(Body& body) {
+	    for(;;) {
+		std::string line = read_line();
+		char* end {nullptr};
+		errno = 0;
+		uint64_t size = strtoull(line.c_str(), &end, 16);
+		if(end == line.c_str() || errno == ERANGE) throw std::runtime_error("Malformed chunk size");
+		if(size == 0) break;
+		while(size > 0) {
+		    fill();
+		    size_t part = std::min<uint64_t>(size, filled_-position_);
+		    consume(body, part);
+		    size -= part;
 		}
-		data.erase(0, pos+http::newline.length());
+		if(!read_line().empty()) throw std::runtime_error("Malformed chunked body");
 	    }
-	    return string;
+	    while(!read_line().empty());
 	}
 
-	std::string Request::get_data_in_chunks(const std::string& response) {
+	Response Request::read_response() {
+	    connection_.quickack();
 #ifdef NCW_DEBUG
 	    auto s {std::chrono::high_resolution_clock::now()};
-	    std::cout << ">read_all_from_buf: ";
+	    std::cout << ">recv_headers: ";
 #endif
-	    auto [data, read_whole] = read_all_from_buf(response);
+	    size_t header_end = body_skipped_ ? header_end_ : recv_headers();
+	    // A 100 Continue that missed the expect wait, or 103 Early Hints,
+	    // precede the real response.
+	    for(uint16_t code; (code = get_status_code(std::string_view{buffer_->data(), header_end})) >= 100 && code < 200 && code != 101;)
+		header_end = recv_headers();
 #ifdef NCW_DEBUG
 	    auto e {std::chrono::high_resolution_clock::now()};
 	    std::chrono::duration<double, std::milli> ms {e - s};
 	    std::cout << ms.count() << std::endl;
 #endif
-	    if(read_whole) return data;
-#ifdef NCW_DEBUG
-	    s = std::chrono::high_resolution_clock::now();
-	    std::cout << ">recv_until_terminator: ";
-#endif
-	    data += recv_until_terminator(std::string(http::chunk_terminator));
-#ifdef NCW_DEBUG
-	    e = std::chrono::high_resolution_clock::now();
-	    ms = e - s;
-	    std::cout << ms.count() << std::endl;
-#endif
-	    data.shrink_to_fit();
+	    auto [headers, status] = parse_headers_status(std::string_view{buffer_->data(), header_end});
+	    if(status == 0) throw std::runtime_error("No HTTP status code found");
+	    if(status < 200 || status >= 300) sink_ = -1;
+	    // HTTP/1.0 closes unless asked not to, HTTP/1.1 stays open unless asked to close.
+	    std::string_view connection {};
+	    if(auto header = headers.find("connection"); header != headers.end()) connection = header->second;
+	    if(std::string_view{buffer_->data(), header_end}.compare(0, 8, "HTTP/1.0") == 0) keep_alive_ = has_token(connection, "keep-alive");
+	    else keep_alive_ = !has_token(connection, "close");
+	    NCW_PROBE(headers_done, connection_.fd, status);
+	    Response response {{}, status, std::move(headers)};
+	    if(method_ == Method::head || method_ == Method::options)
+		return response;
+	    trace::Span receiving {};
 #ifdef NCW_DEBUG
 	    s = std::chrono::high_resolution_clock::now();
-	    std::cout << ">parse_chunks: ";
+	    std::cout << ">read body: ";
 #endif
-	    auto r = parse_chunks(data);
+	    if(auto encoding = response.headers.find("transfer-encoding"); encoding != response.headers.end()) {
+		if(encoding->second == "chunked") read_chunks(response.data);
+	    } else if(auto length = response.headers.find("content-length"); length != response.headers.end()) {
+		char* end {nullptr};
+		uint64_t size = strtoull(length->second.c_str(), &end, 10);
+		if(end == length->second.c_str()) throw std::runtime_error("Invalid Content-Length");
+		read_with_content_length(response.data, size);
+	    }
+	    NCW_PROBE(body_done, connection_.fd, status, response.data.size());
+	    receiving.end("body", url_.hostname);
 #ifdef NCW_DEBUG
 	    e = std::chrono::high_resolution_clock::now();
 	    ms = e - s;
 	    std::cout << ms.count() << std::endl;
 #endif
-	    return r;
+	    buffer_.reset();
+	    return response;
 	}
 
-	Response Request::read_response() {
-#ifdef NCW_DEBUG
-	    auto s {std::chrono::high_resolution_clock::now()};
-	    std::cout << ">recv_until_terminator: ";
-#endif
-	    auto response = recv_until_terminator(std::string(http::terminator));
-#ifdef NCW_DEBUG
-	    auto e {std::chrono::high_resolution_clock::now()};
-	    std::chrono::duration<double, std::milli> ms {e - s};
-	    std::cout << ms.count() << std::endl;
-#endif
-	    auto [headers, status] = parse_headers_status(response);
-	    if(status == 0) throw std::runtime_error("No HTTP status code found");
-	    if(method_ == Method::head || method_ == Method::options)
-		return Response{"", status, headers};
-	    std::string data;
-	    if(headers.find("transfer-encoding") != headers.end()) {
-		if(headers.at("transfer-encoding") == "chunked") data = get_data_in_chunks(response);
-	    } else if(headers.find("content-length") != headers.end())
-		data = get_data_with_content_length(response, headers.at("content-length"));
-	    return Response{data, status, headers};
-	};
-
 	Response Request::perform() {
 	    send_request();
-	    return read_response();
+	    auto* ring = connection_.uring();
+	    try {
+		auto response = read_response();
+		if(ring) ring->finish_recv();
+		return response;
+	    } catch(...) {
+		if(ring) ring->finish_recv();
+		throw;
+	    }
 	}
 
     }
 }
-
@@ -0,0 +1,124 @@
+#include "ncw.hh"
+#include <algorithm>
+
+namespace ncw {
+
+    Scheduler::Ticket::~Ticket() {
+	if(scheduler_) scheduler_->release(origin_);
+    }
+
+    Scheduler::Ticket::Ticket(Ticket&& other) noexcept
+	: scheduler_{other.scheduler_}, origin_{std::move(other.origin_)} {
+	other.scheduler_ = nullptr;
+    }
+
+    Scheduler::Ticket& Scheduler::Ticket::operator=(Ticket&& other) noexcept {
+	if(this != &other) {
+	    if(scheduler_) scheduler_->release(origin_);
+	    scheduler_ = other.scheduler_;
+	    origin_ = std::move(other.origin_);
+	    other.scheduler_ = nullptr;
+	}
+	return *this;
+    }
+
+    void Scheduler::set_weight(const std::string& url, unsigned weight) {
+	std::lock_guard<std::mutex> lock {mutex_};
+	origins_[inner::Url::parse(url).origin()].weight = std::max(1u, weight);
+    }
+
+    void Scheduler::set_rate_limit(const std::string& url, double rate, double burst) {
+	std::lock_guard<std::mutex> lock {mutex_};
+	auto& origin = origins_[inner::Url::parse(url).origin()];
+	origin.rate = rate;
+	origin.burst = std::max(1.0, burst);
+	origin.tokens = origin.burst;
+	origin.refilled = clock::now();
+    }
+
+    bool Scheduler::eligible(Origin& origin, clock::time_point now) {
+	if(origin.in_flight >= max_per_origin_) return false;
+	if(origin.rate <= 0) return true;
+	std::chrono::duration<double> elapsed {now - origin.refilled};
+	origin.tokens = std::min(origin.burst, origin.tokens + elapsed.count()*origin.rate);
+	origin.refilled = now;
+	return origin.tokens >= 1;
+    }
+
+    // Deficit round-robin with unit cost: an origin earns its weight in
+    // credit when its turn comes and keeps the cursor while credit lasts.
+    void Scheduler::dispatch(clock::time_point now) {
+	while(in_flight_ < max_in_flight_ && !active_.empty()) {
+	    bool granted {false};
+	    size_t budget {active_.size()};
+	    while(budget-- > 0 && !active_.empty()) {
+		if(cursor_ == active_.end()) cursor_ = active_.begin();
+		Origin& origin = **cursor_;
+		if(origin.queue.empty()) {
+		    origin.active = false;
+		    origin.deficit = 0;
+		    cursor_ = active_.erase(cursor_);
+		    continue;
+		}
+		if(!eligible(origin, now)) {
+		    cursor_++;
+		    continue;
+		}
+		if(origin.deficit < 1) origin.deficit += origin.weight;
+		auto waiter = origin.queue.begin();
+		waiter->second->granted = true;
+		waiter->second->cv.notify_one();
+		origin.queue.erase(waiter);
+		origin.deficit -= 1;
+		origin.in_flight++;
+		if(origin.rate > 0) origin.tokens -= 1;
+		in_flight_++;
+		if(origin.deficit < 1) cursor_++;
+		granted = true;
+		break;
+	    }
+	    if(!granted) break;
+	}
+    }
+
+    Scheduler::Ticket Scheduler::acquire(const inner::Url& url, int priority) {
+	std::string key {url.origin()};
+	std::unique_lock<std::mutex> lock {mutex_};
+	Origin& origin = origins_[key];
+	Waiter waiter {};
+	origin.queue.emplace(std::make_pair(-priority, sequence_++), &waiter);
+	if(!origin.active) {
+	    origin.active = true;
+	    active_.push_back(&origin);
+	}
+	dispatch(clock::now());
+	while(!waiter.granted) {
+	    if(origin.rate > 0 && origin.tokens < 1) {
+		auto refill = std::chrono::duration_cast<clock::duration>(
+			std::chrono::duration<double>((1 - origin.tokens)/origin.rate));
+		waiter.cv.wait_until(lock, origin.refilled + refill);
+	    } else waiter.cv.wait(lock);
+	    if(!waiter.granted) dispatch(clock::now());
+	}
+	return Ticket{this, std::move(key)};
+    }
+
+    void Scheduler::release(const std::string& key) {
+	std::lock_guard<std::mutex> lock {mutex_};
+	auto& origin = origins_[key];
+	origin.in_flight--;
+	in_flight_--;
+	dispatch(clock::now());
+    }
+
+    static std::shared_ptr<Scheduler> global_scheduler {};
+
+    std::shared_ptr<Scheduler> Scheduler::global() {
+	return std::atomic_load(&global_scheduler);
+    }
+
+    void Scheduler::set_global(std::shared_ptr<Scheduler> scheduler) {
+	std::atomic_store(&global_scheduler, std::move(scheduler));
+    }
+
+}
@@ -0,0 +1,695 @@
+#include "ncw.hh"
+#include "uring.hh"
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <unistd.h>
+
+// Regression checks that need no network access beyond loopback. Each
+// group is one ctest case: ncw-tests <group>.
+
+namespace ncw {
+    namespace tests {
+
+	static int failures {0};
+
+	template <typename A, typename B>
+	static void check_eq(const A& actual, const B& expected, const char* expression, int line) {
+	    if(actual == expected) return;
+	    std::cerr << "tests.cc:" << line << ": " << expression
+		<< "\n  actual:   " << actual << "\n  expected: " << expected << std::endl;
+	    failures++;
+	}
+
+#define CHECK_EQ(actual, expected) check_eq((actual), (expected), #actual, __LINE__)
+
+	// HTTP server on an ephemeral loopback port. It accepts up to connections
+	// connections and serves requests on each until the client closes it or
+	// it stays idle for idle milliseconds. The n-th request gets replies[n],
+	// the last entry repeating, where an empty entry means 200 and the size
+	// of the request body. It keeps the head and body of the last request.
+	// Early parts are sent 50 ms apart right after the request head; if the
+	// last one is a final response, the body is only collected, not answered,
+	// and the connection is closed. The reply pauses 50 ms at every pause
+	// character, so the client receives the parts separately.
+	static constexpr char pause {'\x01'};
+
+	class Server {
+	    private:
+		int listener_ {-1};
+		uint16_t port_ {0};
+		size_t connections_ {1};
+		int idle_ {0};
+		std::thread thread_ {};
+		std::mutex mutex_ {};
+		std::vector<int> open_ {};
+		std::string head_ {};
+		std::string body_ {};
+		std::vector<std::string> replies_ {};
+		std::vector<std::string> early_ {};
+		size_t accepted_ {0};
+		size_t requests_ {0};
+
+		// Returns false once the connection is done.
+		bool serve_request(int fd, std::string& data) {
+		    char buffer[65536];
+		    size_t end {std::string::npos};
+		    while((end = data.find("\r\n\r\n")) == std::string::npos) {
+			ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+			if(n <= 0) return false;
+			data.append(buffer, n);
+		    }
+		    std::string head = data.substr(0, end+4);
+		    std::string body = data.substr(end+4);
+		    data.clear();
+		    std::string reply {};
+		    {
+			std::lock_guard<std::mutex> lock {mutex_};
+			if(!replies_.empty()) reply = replies_[std::min(requests_, replies_.size()-1)];
+			requests_++;
+		    }
+		    bool answered {false};
+		    for(const auto& part: early_) {
+			send(fd, part.data(), part.size(), MSG_NOSIGNAL);
+			answered = part.rfind("HTTP/1.1 1", 0) != 0;
+			std::this_thread::sleep_for(std::chrono::milliseconds(50));
+		    }
+		    if(answered) {
+			timeval timeout {0, 300000};
+			setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+		    }
+		    std::string lower {head};
+		    for(auto& c: lower) c = std::tolower(static_cast<unsigned char>(c));
+		    uint64_t length {0};
+		    if(size_t pos = lower.find("content-length:"); pos != std::string::npos)
+			length = std::stoull(lower.substr(pos+15));
+		    while(body.size() < length) {
+			ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+			if(n <= 0) break;
+			body.append(buffer, n);
+		    }
+		    if(body.size() > length) {
+			data = body.substr(length);
+			body.resize(length);
+		    }
+		    if(reply.empty()) {
+			reply = std::to_string(body.size());
+			reply = "HTTP/1.1 200 OK\r\nConnection: close\r\nContent-Length: "
+			    + std::to_string(reply.size()) + "\r\n\r\n" + reply;
+		    }
+		    {
+			std::lock_guard<std::mutex> lock {mutex_};
+			head_ = std::move(head);
+			body_ = std::move(body);
+		    }
+		    if(answered) return false;
+		    for(size_t begin = 0, end = 0; end != std::string::npos; begin = end+1) {
+			end = reply.find(pause, begin);
+			if(begin > 0) std::this_thread::sleep_for(std::chrono::milliseconds(50));
+			send(fd, reply.data()+begin, (end == std::string::npos ? reply.size() : end)-begin, MSG_NOSIGNAL);
+		    }
+		    return true;
+		}
+
+		void serve_connection(int fd) {
+		    if(idle_ > 0) {
+			timeval timeout {idle_/1000, (idle_%1000)*1000};
+			setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+		    }
+		    std::string data {};
+		    while(serve_request(fd, data));
+		    std::lock_guard<std::mutex> lock {mutex_};
+		    open_.erase(std::find(open_.begin(), open_.end(), fd));
+		    close(fd);
+		}
+
+		void serve() {
+		    std::vector<std::thread> threads {};
+		    while(threads.size() < connections_) {
+			int fd = accept(listener_, nullptr, nullptr);
+			if(fd == -1) break;
+			{
+			    std::lock_guard<std::mutex> lock {mutex_};
+			    open_.push_back(fd);
+			    accepted_++;
+			}
+			threads.emplace_back(&Server::serve_connection, this, fd);
+		    }
+		    for(auto& thread: threads) thread.join();
+		}
+
+	    public:
+		Server(std::vector<std::string> replies = {}, std::vector<std::string> early = {}, size_t connections = 1, int idle = 0)
+		    : connections_{connections}, idle_{idle}, replies_{std::move(replies)}, early_{std::move(early)} {
+		    listener_ = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		    sockaddr_in address {};
+		    address.sin_family = AF_INET;
+		    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		    socklen_t length = sizeof(address);
+		    if(listener_ == -1 || bind(listener_, reinterpret_cast<sockaddr*>(&address), length) == -1
+			    || listen(listener_, 16) == -1
+			    || getsockname(listener_, reinterpret_cast<sockaddr*>(&address), &length) == -1)
+			throw std::runtime_error(strerror(errno));
+		    port_ = ntohs(address.sin_port);
+		    thread_ = std::thread{&Server::serve, this};
+		}
+
+		~Server() {
+		    shutdown(listener_, SHUT_RDWR);
+		    {
+			std::lock_guard<std::mutex> lock {mutex_};
+			for(int fd: open_) shutdown(fd, SHUT_RDWR);
+		    }
+		    if(thread_.joinable()) thread_.join();
+		    close(listener_);
+		}
+
+		inline std::string url(const std::string& path = "/") const { return "http://127.0.0.1:" + std::to_string(port_) + path; }
+		inline uint16_t port() const { return port_; }
+		// Stops accepting and waits for the open connections to close.
+		inline void join() {
+		    shutdown(listener_, SHUT_RDWR);
+		    if(thread_.joinable()) thread_.join();
+		}
+		inline const std::string& head() const { return head_; }
+		inline const std::string& body() const { return body_; }
+		inline size_t accepted() { std::lock_guard<std::mutex> lock {mutex_}; return accepted_; }
+		inline size_t requests() { std::lock_guard<std::mutex> lock {mutex_}; return requests_; }
+	};
+
+	static std::string header(CookieJar& jar, const std::string& url) {
+	    return jar.header(inner::Url::parse(url));
+	}
+
+	static void cookies() {
+	    {
+		// Domain cookies on short second-level names share no bucket
+		// with a "registrable domain" guess of the requesting host.
+		CookieJar jar {};
+		jar.parse("sid=1; Domain=ibm.de", inner::Url::parse("http://www.ibm.de/"));
+		CHECK_EQ(header(jar, "http://www.ibm.de/"), "sid=1");
+		CHECK_EQ(header(jar, "http://ibm.de/"), "sid=1");
+		CHECK_EQ(header(jar, "http://shop.www.ibm.de/"), "sid=1");
+		CHECK_EQ(header(jar, "http://notibm.de/"), "");
+	    }
+	    {
+		CookieJar jar {};
+		jar.parse("token=a; Domain=.foo.io; Path=/", inner::Url::parse("http://api.foo.io/v1/login"));
+		CHECK_EQ(header(jar, "http://api.foo.io/v1"), "token=a");
+		CHECK_EQ(header(jar, "http://foo.io/"), "token=a");
+		CHECK_EQ(header(jar, "http://bar.io/"), "");
+	    }
+	    {
+		CookieJar jar {};
+		jar.parse("a=1; Domain=example.co.uk", inner::Url::parse("http://www.example.co.uk/"));
+		jar.parse("b=2", inner::Url::parse("http://www.example.co.uk/"));
+		CHECK_EQ(header(jar, "http://www.example.co.uk/"), "b=2; a=1");
+		CHECK_EQ(header(jar, "http://img.example.co.uk/"), "a=1");
+	    }
+	    {
+		// Host-only cookies stay on their host, foreign domains are rejected.
+		CookieJar jar {};
+		jar.parse("host=1\nevil=1; Domain=evil.com", inner::Url::parse("http://www.ibm.de/"));
+		CHECK_EQ(header(jar, "http://www.ibm.de/"), "host=1");
+		CHECK_EQ(header(jar, "http://sub.www.ibm.de/"), "");
+		CHECK_EQ(header(jar, "http://evil.com/"), "");
+	    }
+	    {
+		// Shared suffixes cannot be claimed, except as a host-only cookie
+		// by the suffix host itself.
+		CookieJar jar {};
+		jar.parse("super=1; Domain=com", inner::Url::parse("http://www.example.com/"));
+		jar.parse("super=2; Domain=co.uk", inner::Url::parse("http://a.co.uk/"));
+		jar.parse("super=3; Domain=.com.au", inner::Url::parse("http://shop.com.au/"));
+		CHECK_EQ(header(jar, "http://bank.com/"), "");
+		CHECK_EQ(header(jar, "http://www.example.com/"), "");
+		CHECK_EQ(header(jar, "http://bank.co.uk/"), "");
+		CHECK_EQ(header(jar, "http://a.co.uk/"), "");
+		CHECK_EQ(header(jar, "http://bank.com.au/"), "");
+		jar.parse("local=1; Domain=localhost", inner::Url::parse("http://localhost/"));
+		CHECK_EQ(header(jar, "http://localhost/"), "local=1");
+		CHECK_EQ(header(jar, "http://app.localhost/"), "");
+	    }
+	    {
+		CookieJar jar {};
+		jar.parse("s=1; Secure\np=2; Path=/app", inner::Url::parse("https://example.com/"));
+		CHECK_EQ(header(jar, "http://example.com/"), "");
+		CHECK_EQ(header(jar, "https://example.com/app/x"), "p=2; s=1");
+		CHECK_EQ(header(jar, "https://example.com/apple"), "s=1");
+		jar.parse("s=1; Secure; Max-Age=0", inner::Url::parse("https://example.com/"));
+		CHECK_EQ(header(jar, "https://example.com/"), "");
+	    }
+	    {
+		// Replacing a session cookie with an expiring one must schedule
+		// its expiry.
+		CookieJar jar {};
+		jar.parse("s=1", inner::Url::parse("http://example.com/"));
+		CHECK_EQ(header(jar, "http://example.com/"), "s=1");
+		jar.parse("s=2; Max-Age=1", inner::Url::parse("http://example.com/"));
+		CHECK_EQ(header(jar, "http://example.com/"), "s=2");
+		std::this_thread::sleep_for(std::chrono::milliseconds(2100));
+		CHECK_EQ(header(jar, "http://example.com/"), "");
+	    }
+	    {
+		CookieJar jar {};
+		jar.add("any", "1");
+		CHECK_EQ(header(jar, "http://127.0.0.1:8080/"), "any=1");
+		CHECK_EQ(header(jar, "http://a.b.example/"), "any=1");
+	    }
+	}
+
+	static void urls() {
+	    auto base = inner::Url::parse("http://example.com/a/b?q=1");
+	    auto upper = base.resolve("HTTPS://Other.example/x");
+	    CHECK_EQ(upper.scheme, "https");
+	    CHECK_EQ(upper.hostname, "Other.example");
+	    CHECK_EQ(upper.query, "/x");
+	    CHECK_EQ(base.resolve("Http://example.com:8080/y").port, "8080");
+	    CHECK_EQ(base.resolve("c").query, "/a/c");
+	    CHECK_EQ(base.resolve("../d?e").query, "/d?e");
+	    CHECK_EQ(base.resolve("//cdn.example/z").hostname, "cdn.example");
+
+	    // Only a non-default port goes into the Host header.
+	    Server server {};
+	    single::GET(server.url());
+	    server.join();
+	    CHECK_EQ(server.head().find("\r\nHost: 127.0.0.1:" + std::to_string(server.port()) + "\r\n") != std::string::npos, true);
+	}
+
+	static void redirects() {
+	    // A TCP origin cannot send the client to a local Unix socket.
+	    Server server {{"HTTP/1.1 302 Found\r\nLocation: http+unix://%2Ftmp%2Fncw-tests-missing.sock/containers/json\r\n"
+		"Content-Length: 0\r\nConnection: close\r\n\r\n"}};
+	    auto response = single::GET(server.url());
+	    CHECK_EQ(response.status_code, 302);
+
+	    auto local = inner::Url::parse("http+unix://%2Ftmp%2Fa.sock/x");
+	    CHECK_EQ(local.resolve("HTTP+UNIX://%2Ftmp%2Fb.sock/y").socket_path, "/tmp/b.sock");
+	    CHECK_EQ(local.resolve("/z").socket_path, "/tmp/a.sock");
+	}
+
+	// Pooled connections are reused only when the response leaves them open
+	// and are still usable, and preconnect keeps them warm.
+	static void pool() {
+	    const std::vector<std::pair<std::string, size_t>> cases {
+		{"HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nok", 1},
+		{"HTTP/1.1 200 OK\r\nConnection: Close\r\nContent-Length: 2\r\n\r\nok", 2},
+		{"HTTP/1.1 200 OK\r\nConnection: Upgrade, CLOSE\r\nContent-Length: 2\r\n\r\nok", 2},
+		{"HTTP/1.0 200 OK\r\nContent-Length: 2\r\n\r\nok", 2},
+		{"HTTP/1.0 200 OK\r\nConnection: Keep-Alive\r\nContent-Length: 2\r\n\r\nok", 1},
+	    };
+	    for(const auto& [reply, connections]: cases) {
+		// The server leaves every connection open, as if its FIN were
+		// still in flight.
+		Server server {{reply}, {}, 2};
+		{
+		    Session session {};
+		    CHECK_EQ(session.GET(server.url()).status_code, 200);
+		    CHECK_EQ(session.POST(server.url(), "x").status_code, 200);
+		}
+		server.join();
+		CHECK_EQ(server.accepted(), connections);
+		CHECK_EQ(server.requests(), 2u);
+	    }
+
+	    const std::string ok {"HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nok"};
+	    {
+		// Preconnected connections serve the next requests, and a second
+		// preconnect only opens what is missing.
+		Server server {{ok}, {}, 4};
+		{
+		    Session session {};
+		    CHECK_EQ(session.preconnect({server.url()}, 3), 3u);
+		    CHECK_EQ(session.preconnect({server.url()}, 2), 0u);
+		    CHECK_EQ(session.preconnect({server.url()}, 4), 1u);
+		    for(int i = 0; i < 4; i++) CHECK_EQ(session.GET(server.url()).data, "ok");
+		}
+		server.join();
+		CHECK_EQ(server.accepted(), 4u);
+		CHECK_EQ(server.requests(), 4u);
+	    }
+	    {
+		// Connections idle past the timeout are not reused.
+		Server server {{ok}, {}, 2};
+		{
+		    Session session {};
+		    session.set_idle_timeout(1);
+		    CHECK_EQ(session.preconnect({server.url()}), 1u);
+		    std::this_thread::sleep_for(std::chrono::milliseconds(1100));
+		    CHECK_EQ(session.GET(server.url()).data, "ok");
+		}
+		server.join();
+		CHECK_EQ(server.accepted(), 2u);
+	    }
+	    {
+		// The server drops idle connections after 700 ms; the refresh a
+		// second in replaces the dropped one before the request.
+		Server server {{ok}, {}, 3, 700};
+		{
+		    Session session {};
+		    CHECK_EQ(session.preconnect({server.url()}, 1, 1), 1u);
+		    std::this_thread::sleep_for(std::chrono::milliseconds(1300));
+		    CHECK_EQ(server.accepted(), 2u);
+		    CHECK_EQ(session.GET(server.url()).data, "ok");
+		    CHECK_EQ(server.accepted(), 2u);
+		}
+		server.join();
+		CHECK_EQ(server.requests(), 1u);
+	    }
+	}
+
+	// A download retried after its reused connection broke mid-body must not
+	// keep the bytes of the failed attempt.
+	static void downloads() {
+	    std::string partial = "HTTP/1.1 200 OK\r\nContent-Length: 100000\r\n\r\n" + std::string(50000, 'x');
+	    std::string full = "HTTP/1.1 200 OK\r\nContent-Length: 100000\r\n\r\n" + std::string(100000, 'y');
+	    std::string path {"/tmp/ncw-tests-" + std::to_string(getpid()) + ".download"};
+	    for(auto backend: {IoBackend::poll, IoBackend::io_uring}) {
+		if(backend == IoBackend::io_uring && !inner::Uring::local()) continue;
+		SocketOptions options {};
+		options.io_backend = backend;
+		// The first connection is closed once idle after the partial body.
+		Server server {{"HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nok", partial, full}, {}, 2, 200};
+		{
+		    Session session {};
+		    session.set_socket_options(options);
+		    CHECK_EQ(session.GET(server.url()).data, "ok");
+		    CHECK_EQ(session.download(server.url(), path).status_code, 200);
+		}
+		server.join();
+		CHECK_EQ(server.accepted(), 2u);
+		std::ifstream file {path, std::ios::binary};
+		std::string data {std::istreambuf_iterator<char>{file}, std::istreambuf_iterator<char>{}};
+		CHECK_EQ(data.size(), 100000u);
+		CHECK_EQ(data == std::string(100000, 'y'), true);
+	    }
+	    unlink(path.c_str());
+	}
+
+	// Admission limits, fair sharing and rate limiting, without network.
+	static void scheduler() {
+	    auto a = inner::Url::parse("http://a.example/");
+	    auto b = inner::Url::parse("http://b.example/");
+	    // Holds each ticket for a while and reports the peak of concurrent holders.
+	    auto peak = [](Scheduler& scheduler, const std::vector<inner::Url>& urls) {
+		std::mutex mutex {};
+		size_t holding {0};
+		size_t highest {0};
+		std::vector<std::thread> threads {};
+		for(const auto& url: urls)
+		    threads.emplace_back([&, url] {
+			auto ticket = scheduler.acquire(url);
+			{
+			    std::lock_guard<std::mutex> lock {mutex};
+			    highest = std::max(highest, ++holding);
+			}
+			std::this_thread::sleep_for(std::chrono::milliseconds(20));
+			std::lock_guard<std::mutex> lock {mutex};
+			holding--;
+		    });
+		for(auto& thread: threads) thread.join();
+		return highest;
+	    };
+	    {
+		Scheduler scheduler {2, 8};
+		CHECK_EQ(peak(scheduler, {a, b, a, b, a, b, a, b}), 2u);
+	    }
+	    {
+		Scheduler scheduler {64, 2};
+		CHECK_EQ(peak(scheduler, {a, a, a, a, a, a}), 2u);
+		// A full origin does not hold back the others.
+		auto first = scheduler.acquire(a);
+		auto second = scheduler.acquire(a);
+		auto start = std::chrono::steady_clock::now();
+		auto other = scheduler.acquire(b);
+		CHECK_EQ(std::chrono::steady_clock::now()-start < std::chrono::milliseconds(50), true);
+	    }
+	    {
+		// With a single slot, grants alternate by weight: three for a,
+		// then one for b.
+		Scheduler scheduler {1, 8};
+		scheduler.set_weight("http://a.example/", 3);
+		auto held = scheduler.acquire(inner::Url::parse("http://c.example/"));
+		std::mutex mutex {};
+		std::string order {};
+		std::vector<std::thread> threads {};
+		for(const auto* url: {&a, &b}) {
+		    for(int i = 0; i < 8; i++)
+			threads.emplace_back([&, url] {
+			    auto ticket = scheduler.acquire(*url);
+			    std::lock_guard<std::mutex> lock {mutex};
+			    order += url->hostname.front();
+			});
+		    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		}
+		held = Scheduler::Ticket{};
+		for(auto& thread: threads) thread.join();
+		CHECK_EQ(order.size(), 16u);
+		size_t first_a = std::count(order.begin(), order.begin()+8, 'a');
+		CHECK_EQ(first_a >= 5 && first_a <= 7, true);
+		CHECK_EQ(order.substr(12), "bbbb");
+	    }
+	    {
+		// 20 per second with a burst of one: six requests need 250 ms.
+		Scheduler scheduler {};
+		scheduler.set_rate_limit("http://a.example/", 20);
+		auto start = std::chrono::steady_clock::now();
+		for(int i = 0; i < 6; i++) scheduler.acquire(a);
+		auto elapsed = std::chrono::steady_clock::now()-start;
+		CHECK_EQ(elapsed >= std::chrono::milliseconds(240), true);
+		CHECK_EQ(elapsed < std::chrono::milliseconds(1000), true);
+		// Other origins are not throttled.
+		start = std::chrono::steady_clock::now();
+		for(int i = 0; i < 6; i++) scheduler.acquire(b);
+		CHECK_EQ(std::chrono::steady_clock::now()-start < std::chrono::milliseconds(50), true);
+	    }
+	}
+
+	static std::string chunked(const std::string& chunks) {
+	    return "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n" + chunks;
+	}
+
+	static std::string pattern(size_t size) {
+	    std::string data(size, '\0');
+	    for(size_t i = 0; i < size; i++) data[i] = 'a' + i%26;
+	    return data;
+	}
+
+	// Body segments and the response reader, which parses straight out of
+	// 16 KiB receive buffers.
+	static void responses() {
+	    {
+		auto buffer = std::make_shared<const std::string>("abcdefgh");
+		Body body {};
+		body.append(buffer, 2, 3);
+		Body copy {body};
+		CHECK_EQ(copy.string(), "cde");
+		CHECK_EQ(body.segments().front().offset, 2u);
+		CHECK_EQ(body.segments().front().buffer == buffer, true);
+		body.append(buffer, 5, 2);
+		CHECK_EQ(body.segments().size(), 1u);
+		body.append(std::make_shared<const std::string>("xyz"), 0, 3);
+		CHECK_EQ(body.segments().size(), 2u);
+		Body joined {body};
+		CHECK_EQ(joined.view(), "cdefgxyz");
+		CHECK_EQ(joined.segments().size(), 1u);
+		CHECK_EQ(body.segments().size(), 2u);
+		CHECK_EQ(body.size(), 8u);
+		CHECK_EQ(body.string(), "cdefgxyz");
+		CHECK_EQ(body.find("gx"), 4u);
+		CHECK_EQ(Body{}.string(), "");
+	    }
+
+	    // Chunks of varying sizes put size lines across buffer boundaries,
+	    // and pauses split some of them, and a chunk's CRLF, between receives.
+	    std::string large = pattern(150000);
+	    std::string chunks {};
+	    char size_line[32];
+	    for(size_t offset = 0, i = 0; offset < large.size(); i++) {
+		size_t size = std::min(large.size()-offset, i == 3 ? 40000 : (i*7919)%3000 + 1);
+		snprintf(size_line, sizeof(size_line), "%zx\r\n", size);
+		std::string line {size_line};
+		if(i%10 == 5) line.insert(1, 1, pause);
+		chunks += line + large.substr(offset, size) + (i%10 == 7 ? "\r\x01\n" : "\r\n");
+		offset += size;
+	    }
+	    chunks += "0\r\n\r\n";
+	    std::string head = "HTTP/1.1 200 OK\r\nX-Large: " + std::string(40000, 'h') + "\r\nContent-Length: 2\r\n\r\nok";
+
+	    for(auto backend: {IoBackend::poll, IoBackend::io_uring}) {
+		if(backend == IoBackend::io_uring && !inner::Uring::local()) continue;
+		SocketOptions options {};
+		options.io_backend = backend;
+		{
+		    // Extensions and trailers are skipped, leaving the connection
+		    // at the next response.
+		    Server server {{chunked("5;name=value\r\nhe\x01llo\r\n6 ; x\r\n world\r\n0\r\nX-Checksum: 1\r\n\x01X-Other: 2\r\n\x01\r\n"),
+			"HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nok"}};
+		    {
+			Session session {};
+			session.set_socket_options(options);
+			CHECK_EQ(session.GET(server.url()).data, "hello world");
+			CHECK_EQ(session.GET(server.url()).data, "ok");
+		    }
+		    server.join();
+		    CHECK_EQ(server.accepted(), 1u);
+		}
+		for(const auto& reply: {chunked(chunks), "HTTP/1.1 200 OK\r\nContent-Length: 150000\r\n\r\n" + large}) {
+		    Server server {{reply}};
+		    Session session {};
+		    session.set_socket_options(options);
+		    auto response = session.GET(server.url());
+		    CHECK_EQ(response.data.size(), large.size());
+		    CHECK_EQ(response.data == large, true);
+		}
+		{
+		    Server server {{head}};
+		    Session session {};
+		    session.set_socket_options(options);
+		    auto response = session.GET(server.url());
+		    CHECK_EQ(response.headers["x-large"].size(), 40000u);
+		    CHECK_EQ(response.data, "ok");
+		}
+		for(const auto& reply: {chunked("zz\r\nhello\r\n0\r\n\r\n"), chunked("5\r\nhello world\r\n0\r\n\r\n")}) {
+		    Server server {{reply}};
+		    Session session {};
+		    session.set_socket_options(options);
+		    bool thrown {false};
+		    try {
+			session.GET(server.url());
+		    } catch(const std::runtime_error&) {
+			thrown = true;
+		    }
+		    CHECK_EQ(thrown, true);
+		}
+	    }
+	}
+
+	// A final status that follows an interim response must stop the body on
+	// both backends, well before the expect wait runs out.
+	static void expect() {
+	    std::string body(2 << 20, 'x');
+	    for(auto backend: {IoBackend::poll, IoBackend::io_uring}) {
+		if(backend == IoBackend::io_uring && !inner::Uring::local()) continue;
+		SocketOptions options {};
+		options.io_backend = backend;
+		{
+		    Server server {{}, {"HTTP/1.1 103 Early Hints\r\nLink: </a.css>\r\n\r\n",
+			"HTTP/1.1 413 Payload Too Large\r\nContent-Length: 0\r\n\r\n"}};
+		    Session session {};
+		    session.set_socket_options(options);
+		    auto start = std::chrono::steady_clock::now();
+		    auto response = session.POST(server.url(), body);
+		    auto elapsed = std::chrono::steady_clock::now()-start;
+		    server.join();
+		    CHECK_EQ(response.status_code, 413);
+		    CHECK_EQ(server.head().find("Expect: 100-continue") != std::string::npos, true);
+		    CHECK_EQ(server.body().size(), 0u);
+		    CHECK_EQ(elapsed < std::chrono::milliseconds(500), true);
+		}
+		{
+		    Server server {{}, {"HTTP/1.1 100 Continue\r\n\r\n"}};
+		    Session session {};
+		    session.set_socket_options(options);
+		    auto response = session.POST(server.url(), body);
+		    server.join();
+		    CHECK_EQ(response.status_code, 200);
+		    CHECK_EQ(server.body().size(), body.size());
+		}
+	    }
+	}
+
+	// Linked io_uring sends must not let a later part overtake the tail of a
+	// short send, so a large string part is followed by more parts here.
+	static void uploads() {
+	    Multipart form {};
+	    form.add("first", std::string(3 << 20, 'a'));
+	    form.add("second", std::string(3 << 20, 'b'));
+	    form.add("third", "c");
+	    std::string expected {};
+	    for(const auto& part: form.parts())
+		expected += part.head + part.data + "\r\n";
+	    expected += form.closing();
+
+	    // Only regular files have a size to announce.
+	    int pipe_fds[2];
+	    if(pipe(pipe_fds) == 0) {
+		bool rejected {false};
+		try {
+		    Multipart{}.add_fd("pipe", pipe_fds[0], "pipe.bin");
+		} catch(const std::invalid_argument&) {
+		    rejected = true;
+		}
+		CHECK_EQ(rejected, true);
+		close(pipe_fds[0]);
+		close(pipe_fds[1]);
+	    }
+	    std::string fifo {"/tmp/ncw-tests-" + std::to_string(getpid()) + ".fifo"};
+	    if(mkfifo(fifo.c_str(), 0600) == 0) {
+		Multipart named {};
+		named.add_file("fifo", fifo);
+		Server server {};
+		bool rejected {false};
+		try {
+		    Session{}.upload(server.url(), named);
+		} catch(const std::runtime_error&) {
+		    rejected = true;
+		}
+		CHECK_EQ(rejected, true);
+		unlink(fifo.c_str());
+	    }
+
+	    for(auto backend: {IoBackend::poll, IoBackend::io_uring}) {
+		if(backend == IoBackend::io_uring && !inner::Uring::local()) continue;
+		SocketOptions options {};
+		options.io_backend = backend;
+		Server server {};
+		Session session {};
+		session.set_socket_options(options);
+		session.set_expect_continue({0});
+		auto response = session.upload(server.url(), form);
+		server.join();
+		CHECK_EQ(response.status_code, 200);
+		CHECK_EQ(server.body().size(), expected.size());
+		CHECK_EQ(server.body() == expected, true);
+	    }
+	}
+
+    }
+}
+
+int main(int argc, char** argv) {
+    const std::map<std::string, void (*)()> groups {
+	{"cookies", ncw::tests::cookies},
+	{"urls", ncw::tests::urls},
+	{"pool", ncw::tests::pool},
+	{"downloads", ncw::tests::downloads},
+	{"responses", ncw::tests::responses},
+	{"scheduler", ncw::tests::scheduler},
+	{"expect", ncw::tests::expect},
+	{"redirects", ncw::tests::redirects},
+	{"uploads", ncw::tests::uploads},
+    };
+    if(argc != 2 || groups.find(argv[1]) == groups.end()) {
+	std::cerr << "Usage: ncw-tests <group>" << std::endl;
+	return 2;
+    }
+    groups.at(argv[1])();
+    return ncw::tests::failures ? 1 : 0;
+}
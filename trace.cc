@@ -0,0 +1,114 @@
+#include "ncw.hh"
+#include "trace.hh"
+#include <chrono>
+#include <fstream>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace ncw {
+    namespace inner {
+	namespace trace {
+
+	    static constexpr size_t max_events {1 << 20};
+
+	    struct Event {
+		const char* name;
+		char phase;
+		uint32_t tid;
+		uint64_t begin;
+		uint64_t duration;
+		std::string detail;
+	    };
+
+	    std::atomic<bool> enabled {false};
+	    static std::mutex mutex {};
+	    static std::vector<Event> events {};
+
+	    uint64_t now() {
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+	    }
+
+	    static uint32_t thread_id() {
+		static thread_local uint32_t tid = syscall(SYS_gettid);
+		return tid;
+	    }
+
+	    static void record(const char* name, char phase, uint64_t begin, uint64_t end, std::string_view detail) {
+		std::lock_guard<std::mutex> lock {mutex};
+		if(events.size() >= max_events) return;
+		events.push_back(Event{name, phase, thread_id(), begin, end-begin, std::string{detail}});
+	    }
+
+	    void complete(const char* name, uint64_t begin, std::string_view detail) {
+		record(name, 'X', begin, now(), detail);
+	    }
+
+	    void instant(const char* name, std::string_view detail) {
+		if(!recording()) return;
+		uint64_t time = now();
+		record(name, 'i', time, time, detail);
+	    }
+
+	    static void write_string(std::ostream& stream, std::string_view value) {
+		static constexpr char digits[] {"0123456789abcdef"};
+		stream << '"';
+		for(char c: value) {
+		    if(c == '"' || c == '\\') stream << '\\' << c;
+		    else if(static_cast<unsigned char>(c) < 0x20)
+			stream << "\\u00" << digits[(c >> 4) & 15] << digits[c & 15];
+		    else stream << c;
+		}
+		stream << '"';
+	    }
+
+	}
+    }
+
+    namespace trace {
+
+	void start() {
+	    inner::trace::enabled.store(true, std::memory_order_relaxed);
+	}
+
+	void stop() {
+	    inner::trace::enabled.store(false, std::memory_order_relaxed);
+	}
+
+	void clear() {
+	    std::lock_guard<std::mutex> lock {inner::trace::mutex};
+	    inner::trace::events.clear();
+	}
+
+	// Chrome trace-event format: timestamps and durations in microseconds.
+	void save(const std::string& path) {
+	    std::ofstream file {path, std::ios::trunc};
+	    if(!file) throw std::runtime_error("Cannot open trace file " + path);
+	    int pid = getpid();
+	    std::lock_guard<std::mutex> lock {inner::trace::mutex};
+	    file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+	    bool first {true};
+	    for(const auto& event: inner::trace::events) {
+		file << (first ? "\n" : ",\n") << "{\"name\":\"" << event.name
+		    << "\",\"cat\":\"ncw\",\"ph\":\"" << event.phase
+		    << "\",\"pid\":" << pid << ",\"tid\":" << event.tid
+		    << ",\"ts\":" << event.begin/1000 << '.' << event.begin%1000/100;
+		if(event.phase == 'X') file << ",\"dur\":" << event.duration/1000 << '.' << event.duration%1000/100;
+		else file << ",\"s\":\"t\"";
+		if(!event.detail.empty()) {
+		    file << ",\"args\":{\"detail\":";
+		    inner::trace::write_string(file, event.detail);
+		    file << '}';
+		}
+		file << '}';
+		first = false;
+	    }
+	    file << "\n]}\n";
+	    if(!file) throw std::runtime_error("Cannot write trace file " + path);
+	}
+
+    }
+}
@@ -0,0 +1,50 @@
+#ifndef NCW_TRACE_H_
+#define NCW_TRACE_H_
+
+#include <atomic>
+#include <cstdint>
+#include <string_view>
+
+// Static tracepoints in the "ncw" provider, compiled in when sys/sdt.h is
+// available. A disabled probe is a single nop, and bpftrace or perf can
+// attach to it without a rebuild:
+//   bpftrace -e 'usdt:./ncw-cli:ncw:dns_done { printf("%s\n", str(arg0)); }'
+#ifdef NCW_USDT
+#include <sys/sdt.h>
+#define NCW_PROBE(...) STAP_PROBEV(ncw, __VA_ARGS__)
+#else
+#define NCW_PROBE(...) do {} while(0)
+#endif
+
+namespace ncw {
+    namespace inner {
+	namespace trace {
+
+	    extern std::atomic<bool> enabled;
+
+	    inline bool recording() { return enabled.load(std::memory_order_relaxed); }
+	    uint64_t now();
+	    void complete(const char* name, uint64_t begin, std::string_view detail);
+	    void instant(const char* name, std::string_view detail);
+
+	    // Phase timer for the in-process recorder. Nothing is read or stored
+	    // unless recording was on when the phase began.
+	    class Span {
+		private:
+		    uint64_t begin_;
+
+		public:
+		    inline Span() : begin_{recording() ? now() : 0} {}
+		    // Lets callers skip building a detail string nobody records.
+		    inline bool active() const { return begin_ != 0; }
+		    inline void end(const char* name, std::string_view detail = {}) {
+			if(begin_) complete(name, begin_, detail);
+			begin_ = 0;
+		    }
+	    };
+
+	}
+    }
+}
+
+#endif
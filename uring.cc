@@ -0,0 +1,458 @@
+#include "uring.hh"
+#include <stdexcept>
+
+#ifdef NCW_IO_URING
+
+#include <algorithm>
+#include <chrono>
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#include <csignal>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace ncw {
+    namespace inner {
+
+	static constexpr unsigned ring_entries {64};
+	static constexpr unsigned buffer_count {64};
+	static constexpr unsigned buffer_size {16384};
+	static constexpr uint16_t buffer_group {0};
+
+	enum Tag : uint64_t {
+	    tag_recv = 1,
+	    tag_send,
+	    tag_connect,
+	    tag_write,
+	    tag_cancel,
+	};
+
+	static int uring_setup(unsigned entries, io_uring_params* params) {
+	    return syscall(__NR_io_uring_setup, entries, params);
+	}
+
+	static int uring_enter(int fd, unsigned submit, unsigned wait, unsigned flags, void* arg, size_t size) {
+	    return syscall(__NR_io_uring_enter, fd, submit, wait, flags, arg, size);
+	}
+
+	static int uring_register(int fd, unsigned opcode, void* arg, unsigned count) {
+	    return syscall(__NR_io_uring_register, fd, opcode, arg, count);
+	}
+
+	Uring::Uring() {
+	    io_uring_params params {};
+	    if((ring_fd_ = uring_setup(ring_entries, &params)) < 0)
+		throw std::runtime_error(strerror(errno));
+	    if(!(params.features & IORING_FEAT_SINGLE_MMAP) || !(params.features & IORING_FEAT_EXT_ARG)) {
+		release();
+		throw std::runtime_error("io_uring is missing required features");
+	    }
+
+	    sq_ring_size_ = params.sq_off.array + params.sq_entries*sizeof(unsigned);
+	    cq_ring_size_ = params.cq_off.cqes + params.cq_entries*sizeof(io_uring_cqe);
+	    sq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+	    sq_ring_ = mmap(nullptr, sq_ring_size_, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+	    sqes_size_ = params.sq_entries*sizeof(io_uring_sqe);
+	    sqes_ = static_cast<io_uring_sqe*>(mmap(nullptr, sqes_size_, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, ring_fd_, IORING_OFF_SQES));
+	    if(sq_ring_ == MAP_FAILED || sqes_ == MAP_FAILED) {
+		if(sq_ring_ == MAP_FAILED) sq_ring_ = nullptr;
+		if(sqes_ == MAP_FAILED) sqes_ = nullptr;
+		release();
+		throw std::runtime_error("Cannot map io_uring");
+	    }
+	    cq_ring_ = sq_ring_;
+
+	    char* sq = static_cast<char*>(sq_ring_);
+	    sq_head_ = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+	    sq_tail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+	    sq_array_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+	    sq_mask_ = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+	    sq_entries_ = params.sq_entries;
+	    char* cq = static_cast<char*>(cq_ring_);
+	    cq_head_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+	    cq_tail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+	    cq_mask_ = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+	    cqes_ = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+	    buffer_ring_size_ = buffer_count*sizeof(io_uring_buf) + buffer_count*buffer_size;
+	    buffer_ring_ = mmap(nullptr, buffer_ring_size_, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+	    if(buffer_ring_ == MAP_FAILED) {
+		buffer_ring_ = nullptr;
+		release();
+		throw std::bad_alloc();
+	    }
+	    buffers_ = static_cast<char*>(buffer_ring_) + buffer_count*sizeof(io_uring_buf);
+	    io_uring_buf_reg reg {};
+	    reg.ring_addr = reinterpret_cast<uint64_t>(buffer_ring_);
+	    reg.ring_entries = buffer_count;
+	    reg.bgid = buffer_group;
+	    if(uring_register(ring_fd_, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+		int error = errno;
+		release();
+		throw std::runtime_error(strerror(error));
+	    }
+	    for(uint16_t id = 0; id < buffer_count; id++) recycle(id);
+	}
+
+	void Uring::release() {
+	    if(buffer_ring_) munmap(buffer_ring_, buffer_ring_size_);
+	    if(sqes_) munmap(sqes_, sqes_size_);
+	    if(sq_ring_) munmap(sq_ring_, sq_ring_size_);
+	    if(ring_fd_ >= 0) close(ring_fd_);
+	    buffer_ring_ = nullptr;
+	    sqes_ = nullptr;
+	    sq_ring_ = cq_ring_ = nullptr;
+	    ring_fd_ = -1;
+	}
+
+	Uring::~Uring() {
+	    release();
+	}
+
+	Uring* Uring::local() {
+	    static std::atomic<bool> unsupported {false};
+	    thread_local std::unique_ptr<Uring> ring {};
+	    thread_local bool tried {false};
+	    if(!tried && !unsupported.load(std::memory_order_relaxed)) {
+		tried = true;
+		try {
+		    ring.reset(new Uring{});
+		} catch(const std::exception&) {
+		    unsupported.store(true, std::memory_order_relaxed);
+		}
+	    }
+	    return ring.get();
+	}
+
+	io_uring_sqe* Uring::get_sqe() {
+	    unsigned tail = *sq_tail_;
+	    if(tail - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) >= sq_entries_) {
+		submit(0, 0);
+		tail = *sq_tail_;
+	    }
+	    unsigned index = tail & sq_mask_;
+	    io_uring_sqe* sqe = &sqes_[index];
+	    memset(sqe, 0, sizeof(*sqe));
+	    sq_array_[index] = index;
+	    __atomic_store_n(sq_tail_, tail+1, __ATOMIC_RELEASE);
+	    pending_++;
+	    return sqe;
+	}
+
+	// Returns false when the wait timed out.
+	bool Uring::enter(unsigned wait, const __kernel_timespec* ts) {
+	    io_uring_getevents_arg arg {};
+	    arg.sigmask_sz = _NSIG/8;
+	    arg.ts = reinterpret_cast<uint64_t>(ts);
+	    unsigned flags = IORING_ENTER_EXT_ARG | (wait ? IORING_ENTER_GETEVENTS : 0);
+	    while(true) {
+		int ret = uring_enter(ring_fd_, pending_, wait, flags, &arg, sizeof(arg));
+		if(ret >= 0) {
+		    pending_ -= std::min<unsigned>(ret, pending_);
+		    if(!wait || ret > 0 || pending_ == 0) return true;
+		    continue;
+		}
+		if(errno == EINTR) continue;
+		if(errno == ETIME) return false;
+		throw std::runtime_error(strerror(errno));
+	    }
+	}
+
+	void Uring::submit(unsigned wait, uint64_t timeout) {
+	    struct __kernel_timespec ts {static_cast<long long>(timeout), 0};
+	    if(!enter(wait, timeout ? &ts : nullptr)) throw std::runtime_error("Polling timeout");
+	}
+
+	// Wait for at least one completion and dispatch everything available.
+	void Uring::reap(uint64_t timeout) {
+	    unsigned head = *cq_head_;
+	    if(head == __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE)) {
+		submit(1, timeout);
+		head = *cq_head_;
+	    }
+	    while(head != __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE)) {
+		const io_uring_cqe* cqe = &cqes_[head & cq_mask_];
+		uint64_t user_data = cqe->user_data;
+		int32_t res = cqe->res;
+		uint32_t flags = cqe->flags;
+		__atomic_store_n(cq_head_, ++head, __ATOMIC_RELEASE);
+		complete(user_data, res, flags);
+		head = *cq_head_;
+	    }
+	}
+
+	// io_uring_buf_ring::bufs is a flexible array that C++ compilers place
+	// after an empty struct, so entries are addressed from the ring base.
+	void Uring::recycle(uint16_t id) {
+	    auto* ring = static_cast<io_uring_buf_ring*>(buffer_ring_);
+	    io_uring_buf* buf = static_cast<io_uring_buf*>(buffer_ring_) + (buffer_tail_ & (buffer_count-1));
+	    buf->addr = reinterpret_cast<uint64_t>(buffers_ + static_cast<size_t>(id)*buffer_size);
+	    buf->len = buffer_size;
+	    buf->bid = id;
+	    __atomic_store_n(&ring->tail, ++buffer_tail_, __ATOMIC_RELEASE);
+	}
+
+	void Uring::complete(uint64_t user_data, int32_t res, uint32_t flags) {
+	    switch(user_data & 0xff) {
+		case tag_recv: {
+		    if(!(flags & IORING_CQE_F_MORE)) recv_armed_ = false;
+		    if(res == 0) recv_closed_ = true;
+		    else if(res < 0) {
+			if(res != -ENOBUFS && res != -ECANCELED) recv_error_ = -res;
+		    }
+		    if(!(flags & IORING_CQE_F_BUFFER)) break;
+		    uint16_t id = flags >> IORING_CQE_BUFFER_SHIFT;
+		    if(res <= 0) {
+			recycle(id);
+			break;
+		    }
+		    const char* data = buffers_ + static_cast<size_t>(id)*buffer_size;
+		    size_t size = res;
+		    if(sink_fd_ >= 0 && sink_remaining_ > 0) {
+			size_t n = std::min<uint64_t>(size, sink_remaining_);
+			io_uring_sqe* sqe = get_sqe();
+			sqe->opcode = IORING_OP_WRITE;
+			sqe->fd = sink_fd_;
+			sqe->addr = reinterpret_cast<uint64_t>(data);
+			sqe->len = n;
+			sqe->off = sink_offset_;
+			sqe->user_data = tag_write | (static_cast<uint64_t>(id) << 8) | (static_cast<uint64_t>(n) << 24);
+			sink_offset_ += n;
+			sink_remaining_ -= n;
+			writes_pending_++;
+			if(n < size) staged_.insert(staged_.end(), data+n, data+size);
+		    } else {
+			staged_.insert(staged_.end(), data, data+size);
+			recycle(id);
+		    }
+		    break;
+		}
+		case tag_write:
+		    recycle((user_data >> 8) & 0xffff);
+		    writes_pending_--;
+		    if(res < 0) write_error_ = -res;
+		    else if(static_cast<uint64_t>(res) != (user_data >> 24)) write_error_ = EIO;
+		    break;
+		case tag_connect:
+		case tag_send: {
+		    size_t index = user_data >> 8;
+		    if(index < send_results_.size()) send_results_[index] = res;
+		    sends_pending_--;
+		    break;
+		}
+		default:
+		    break;
+	    }
+	}
+
+	void Uring::arm_recv(int fd) {
+	    if(recv_armed_ && recv_fd_ == fd) return;
+	    if(recv_fd_ != fd) finish_recv();
+	    io_uring_sqe* sqe = get_sqe();
+	    sqe->opcode = IORING_OP_RECV;
+	    sqe->fd = fd;
+	    sqe->flags = IOSQE_BUFFER_SELECT;
+	    sqe->buf_group = buffer_group;
+	    sqe->ioprio = IORING_RECV_MULTISHOT;
+	    sqe->user_data = tag_recv;
+	    submit(0, 0);
+	    recv_fd_ = fd;
+	    recv_armed_ = true;
+	    recv_closed_ = false;
+	    recv_error_ = 0;
+	}
+
+	size_t Uring::recv(int fd, char* buffer, size_t size, uint64_t timeout) {
+	    if(recv_fd_ != fd) finish_recv();
+	    while(staged_pos_ == staged_.size()) {
+		staged_.clear();
+		staged_pos_ = 0;
+		if(recv_error_) {
+		    int error = recv_error_;
+		    recv_error_ = 0;
+		    throw std::runtime_error(strerror(error));
+		}
+		if(recv_closed_) {
+		    recv_closed_ = false;
+		    throw std::runtime_error("Peer closed connection");
+		}
+		if(!recv_armed_) arm_recv(fd);
+		reap(timeout);
+	    }
+	    size_t n = std::min(size, staged_.size()-staged_pos_);
+	    memcpy(buffer, staged_.data()+staged_pos_, n);
+	    staged_pos_ += n;
+	    return n;
+	}
+
+	// Data taken by the multishot receive never shows up in poll(), so
+	// bounded waits on a ring socket go through the ring. Errors and EOF
+	// count as ready; the next recv reports them.
+	bool Uring::wait_recv(int fd, int timeout) {
+	    if(recv_fd_ != fd) finish_recv();
+	    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout);
+	    while(staged_pos_ == staged_.size() && !recv_error_ && !recv_closed_) {
+		if(!recv_armed_) arm_recv(fd);
+		if(*cq_head_ == __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE)) {
+		    auto left = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline-std::chrono::steady_clock::now()).count();
+		    if(left <= 0) return false;
+		    struct __kernel_timespec ts {left / 1000000000, left % 1000000000};
+		    if(!enter(1, &ts)) return false;
+		    continue;
+		}
+		reap(0);
+	    }
+	    return true;
+	}
+
+	// Stops the multishot receive once a response is complete so no
+	// buffers stay attached to an idle pooled socket.
+	void Uring::finish_recv() {
+	    if(recv_armed_) {
+		io_uring_sqe* sqe = get_sqe();
+		sqe->opcode = IORING_OP_ASYNC_CANCEL;
+		sqe->addr = tag_recv;
+		sqe->user_data = tag_cancel;
+		while(recv_armed_) reap(0);
+	    }
+	    recv_fd_ = -1;
+	    recv_closed_ = false;
+	    recv_error_ = 0;
+	    staged_.clear();
+	    staged_pos_ = 0;
+	}
+
+	bool Uring::transmit(int fd, const sockaddr* address, socklen_t length,
+		const std::string_view* parts, size_t count) {
+	    std::vector<std::string_view> remaining {};
+	    for(size_t i = 0; i < count; i++)
+		if(!parts[i].empty()) remaining.push_back(parts[i]);
+
+	    while(address || !remaining.empty()) {
+		size_t offset = address ? 1 : 0;
+		send_results_.assign(remaining.size() + offset, INT_MIN);
+		sends_pending_ = send_results_.size();
+		if(address) {
+		    io_uring_sqe* sqe = get_sqe();
+		    sqe->opcode = IORING_OP_CONNECT;
+		    sqe->fd = fd;
+		    sqe->addr = reinterpret_cast<uint64_t>(address);
+		    sqe->off = length;
+		    sqe->flags = remaining.empty() ? 0 : IOSQE_IO_LINK;
+		    sqe->user_data = tag_connect;
+		}
+		for(size_t i = 0; i < remaining.size(); i++) {
+		    io_uring_sqe* sqe = get_sqe();
+		    sqe->opcode = IORING_OP_SEND;
+		    sqe->fd = fd;
+		    sqe->addr = reinterpret_cast<uint64_t>(remaining[i].data());
+		    sqe->len = remaining[i].size();
+		    // MSG_WAITALL makes a short send fail the link, so no later
+		    // part can go out ahead of the unsent tail.
+		    sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+		    sqe->flags = i+1 < remaining.size() ? IOSQE_IO_LINK : 0;
+		    sqe->user_data = tag_send | ((i+offset) << 8);
+		}
+		while(sends_pending_) reap(0);
+
+		if(address) {
+		    // The sends linked behind a failed connect never ran.
+		    if(send_results_[0] < 0) return false;
+		    address = nullptr;
+		}
+		size_t done {0};
+		for(; done < remaining.size(); done++) {
+		    int res = send_results_[done+offset];
+		    if(res == -ECANCELED) break;
+		    if(res < 0) throw std::runtime_error(strerror(-res));
+		    if(static_cast<size_t>(res) < remaining[done].size()) {
+			// Kernels that ignore MSG_WAITALL here keep running the
+			// link, and the stream is already out of order.
+			if(done+1 < remaining.size() && send_results_[done+offset+1] != -ECANCELED)
+			    throw std::runtime_error("Short io_uring send");
+			remaining[done].remove_prefix(res);
+			break;
+		    }
+		}
+		remaining.erase(remaining.begin(), remaining.begin()+done);
+	    }
+	    return true;
+	}
+
+	void Uring::send(int fd, const std::string_view* parts, size_t count) {
+	    transmit(fd, nullptr, 0, parts, count);
+	}
+
+	bool Uring::connect_send(int fd, const sockaddr* address, socklen_t length,
+		const std::string_view* parts, size_t count) {
+	    return transmit(fd, address, length, parts, count);
+	}
+
+	void Uring::recv_to_file(int fd, int file, uint64_t offset, uint64_t length, uint64_t timeout) {
+	    if(recv_fd_ != fd) finish_recv();
+	    size_t staged = std::min<uint64_t>(staged_.size()-staged_pos_, length);
+	    while(staged > 0) {
+		ssize_t written = pwrite(file, staged_.data()+staged_pos_, staged, offset);
+		if(written < 0) {
+		    if(errno == EINTR) continue;
+		    throw std::runtime_error(strerror(errno));
+		}
+		staged_pos_ += written;
+		staged -= written;
+		offset += written;
+		length -= written;
+	    }
+	    if(staged_pos_ == staged_.size()) {
+		staged_.clear();
+		staged_pos_ = 0;
+	    }
+
+	    sink_fd_ = file;
+	    sink_offset_ = offset;
+	    sink_remaining_ = length;
+	    write_error_ = 0;
+	    try {
+		while(sink_remaining_ > 0) {
+		    if(recv_error_) throw std::runtime_error(strerror(recv_error_));
+		    if(recv_closed_) throw std::runtime_error("Peer closed connection");
+		    if(!recv_armed_) arm_recv(fd);
+		    reap(timeout);
+		}
+		while(writes_pending_) reap(0);
+	    } catch(...) {
+		while(writes_pending_) reap(0);
+		sink_fd_ = -1;
+		throw;
+	    }
+	    sink_fd_ = -1;
+	    if(write_error_) throw std::runtime_error(strerror(write_error_));
+	}
+
+    }
+}
+
+#else
+
+namespace ncw {
+    namespace inner {
+
+	Uring::Uring() { throw std::runtime_error("Built without io_uring support"); }
+	Uring::~Uring() {}
+	Uring* Uring::local() { return nullptr; }
+	size_t Uring::recv(int, char*, size_t, uint64_t) { throw std::logic_error("io_uring unavailable"); }
+	void Uring::finish_recv() {}
+	bool Uring::wait_recv(int, int) { throw std::logic_error("io_uring unavailable"); }
+	void Uring::send(int, const std::string_view*, size_t) { throw std::logic_error("io_uring unavailable"); }
+	bool Uring::connect_send(int, const sockaddr*, socklen_t, const std::string_view*, size_t) { throw std::logic_error("io_uring unavailable"); }
+	void Uring::recv_to_file(int, int, uint64_t, uint64_t, uint64_t) { throw std::logic_error("io_uring unavailable"); }
+
+    }
+}
+
+#endif
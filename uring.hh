@@ -0,0 +1,96 @@
+#ifndef NCW_URING_H_
+#define NCW_URING_H_
+
+#include <cstdint>
+#include <string_view>
+#include <vector>
+#include <sys/socket.h>
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+struct __kernel_timespec;
+
+namespace ncw {
+    namespace inner {
+
+	// Minimal io_uring driver for plain sockets, one ring per thread.
+	// Responses are read with a single multishot receive into a ring of
+	// kernel-provided buffers, request parts go out as linked sends in one
+	// submission, and download bodies are written to the file straight from
+	// the receive buffers.
+	class Uring {
+	    private:
+		int ring_fd_ {-1};
+		void* sq_ring_ {nullptr};
+		size_t sq_ring_size_ {0};
+		void* cq_ring_ {nullptr};
+		size_t cq_ring_size_ {0};
+		io_uring_sqe* sqes_ {nullptr};
+		size_t sqes_size_ {0};
+		unsigned* sq_head_ {nullptr};
+		unsigned* sq_tail_ {nullptr};
+		unsigned* sq_array_ {nullptr};
+		unsigned sq_mask_ {0};
+		unsigned sq_entries_ {0};
+		unsigned* cq_head_ {nullptr};
+		unsigned* cq_tail_ {nullptr};
+		unsigned cq_mask_ {0};
+		io_uring_cqe* cqes_ {nullptr};
+		unsigned pending_ {0};
+
+		void* buffer_ring_ {nullptr};
+		size_t buffer_ring_size_ {0};
+		char* buffers_ {nullptr};
+		uint16_t buffer_tail_ {0};
+
+		int recv_fd_ {-1};
+		bool recv_armed_ {false};
+		bool recv_closed_ {false};
+		int recv_error_ {0};
+		std::vector<char> staged_ {};
+		size_t staged_pos_ {0};
+
+		int sink_fd_ {-1};
+		uint64_t sink_offset_ {0};
+		uint64_t sink_remaining_ {0};
+		unsigned writes_pending_ {0};
+		int write_error_ {0};
+
+		std::vector<int> send_results_ {};
+		unsigned sends_pending_ {0};
+
+		Uring();
+		void release();
+		io_uring_sqe* get_sqe();
+		bool enter(unsigned wait, const __kernel_timespec* ts);
+		void submit(unsigned wait, uint64_t timeout);
+		void reap(uint64_t timeout);
+		void complete(uint64_t user_data, int32_t res, uint32_t flags);
+		void recycle(uint16_t id);
+		void arm_recv(int fd);
+		bool transmit(int fd, const sockaddr* address, socklen_t length,
+			const std::string_view* parts, size_t count);
+
+	    public:
+		~Uring();
+		Uring(const Uring&) = delete;
+		Uring& operator=(const Uring&) = delete;
+
+		// Ring of the calling thread, or nullptr when the kernel refuses
+		// io_uring or lacks multishot receive and provided buffer rings.
+		static Uring* local();
+
+		size_t recv(int fd, char* buffer, size_t size, uint64_t timeout);
+		bool wait_recv(int fd, int timeout);
+		void finish_recv();
+		void send(int fd, const std::string_view* parts, size_t count);
+		// Returns false, with nothing sent, when the connect itself fails.
+		bool connect_send(int fd, const sockaddr* address, socklen_t length,
+			const std::string_view* parts, size_t count);
+		void recv_to_file(int fd, int file, uint64_t offset, uint64_t length, uint64_t timeout);
+	};
+
+    }
+}
+
+#endif
@@ -1,4 +1,7 @@
 #include "ncw.hh"
+#include <cctype>
+#include <stdexcept>
+#include <strings.h>
 
 namespace ncw {
     namespace inner {
@@ -7,27 +10,30 @@ namespace ncw {
 	    bool has_prefix {false};
 	    std::string port {};
 	    size_t pos {0};
-	    if(url.find(http::prefix_https) != std::string::npos) {
+	    if(url.rfind(http::prefix_https, 0) == 0) {
 		port = "443";
 		has_prefix = true;
-	    } else if(url.find(http::prefix_http) != std::string::npos) {
+		pos = http::prefix_https.size();
+	    } else if(url.rfind(http::prefix_http, 0) == 0) {
 		port = "80";
 		has_prefix = true;
-	    } else if((pos = url.find(':')) != std::string::npos) {
-		while(std::isdigit(url[pos])) {
-		    port += url[pos];
-		    pos++;
-		}
+		pos = http::prefix_http.size();
 	    } else {
 		port = "80";
 	    }
+	    size_t end = url.find('/', pos);
+	    if((pos = url.find(':', pos)) != std::string::npos && pos < end) {
+		std::string explicit_port {};
+		while(++pos < url.size() && std::isdigit(url[pos]))
+		    explicit_port += url[pos];
+		if(!explicit_port.empty()) port = explicit_port;
+	    }
 	    return std::make_pair(port, has_prefix);
 	}
 
 	static std::string get_hostname(const std::string& url) {
 	    size_t pos {0};
-	    if((pos = url.find(':')) != std::string::npos 
-		    || (pos = url.find('/')) != std::string::npos)
+	    if((pos = url.find_first_of(":/?#")) != std::string::npos)
 		return url.substr(0, pos);
 	    else
 		return url;
@@ -35,19 +41,126 @@ namespace ncw {
 
 	static std::string get_query(const std::string& url) {
 	    size_t pos {0};
-	    if((pos = url.find('/')) != std::string::npos)
-		return url.substr(pos);
-	    else return "/";
+	    std::string query {"/"};
+	    if((pos = url.find_first_of("/?")) != std::string::npos)
+		query = url[pos] == '/' ? url.substr(pos) : "/" + url.substr(pos);
+	    if((pos = query.find('#')) != std::string::npos)
+		query.erase(pos);
+	    return query;
+	}
+
+	// RFC 3986 section 5.2.4, applied to the path part only.
+	static std::string remove_dot_segments(const std::string& path) {
+	    std::string output {};
+	    size_t pos {0};
+	    while(pos < path.size()) {
+		size_t next = path.find('/', pos+1);
+		if(next == std::string::npos) next = path.size();
+		std::string segment = path.substr(pos, next-pos);
+		if(segment == "/.." || segment == "/../") {
+		    size_t last = output.rfind('/');
+		    output.erase(last == std::string::npos ? 0 : last);
+		    if(next == path.size()) output += '/';
+		} else if(segment == "/.") {
+		    if(next == path.size()) output += '/';
+		} else output += segment;
+		pos = next;
+	    }
+	    return output.empty() ? "/" : output;
+	}
+
+	static int hex_value(char c) {
+	    if(c >= '0' && c <= '9') return c-'0';
+	    if(c >= 'a' && c <= 'f') return c-'a'+10;
+	    if(c >= 'A' && c <= 'F') return c-'A'+10;
+	    return -1;
+	}
+
+	static std::string percent_decode(const std::string& encoded) {
+	    std::string decoded {};
+	    for(size_t i = 0; i < encoded.size(); i++) {
+		int high {0}, low {0};
+		if(encoded[i] == '%' && i+2 < encoded.size()
+			&& (high = hex_value(encoded[i+1])) >= 0 && (low = hex_value(encoded[i+2])) >= 0) {
+		    decoded += static_cast<char>(high << 4 | low);
+		    i += 2;
+		} else decoded += encoded[i];
+	    }
+	    return decoded;
+	}
+
+	static std::string percent_encode(const std::string& raw) {
+	    static constexpr char digits[] {"0123456789ABCDEF"};
+	    std::string encoded {};
+	    for(unsigned char c: raw) {
+		if(std::isalnum(c) || c == '-' || c == '.' || c == '_' || c == '~' || c == '@') encoded += c;
+		else {
+		    encoded += '%';
+		    encoded += digits[c >> 4];
+		    encoded += digits[c & 15];
+		}
+	    }
+	    return encoded;
+	}
+
+	// http+unix://<percent-encoded socket path>/path?query, the form used by
+	// requests-unixsocket. Requests carry "Host: localhost".
+	static Url parse_unix(const std::string& url) {
+	    std::string rest {url.substr(http::prefix_http_unix.size())};
+	    std::string authority {rest.substr(0, rest.find_first_of("/?#"))};
+	    if(authority.empty())
+		throw std::invalid_argument("Missing socket path in " + url);
+	    return Url{url, "localhost", "", get_query(rest), "http+unix", percent_decode(authority)};
 	}
 
 	Url Url::parse(const std::string& url) {
 	    if(url.empty())
 		throw std::invalid_argument("Cannot perform request with empty URL");
+	    if(url.rfind(http::prefix_http_unix, 0) == 0)
+		return parse_unix(url);
 	    auto [port, has_prefix] = get_port(url);
+	    auto scheme {url.rfind(http::prefix_https, 0) == 0 ? "https" : "http"};
 	    auto tmp_url {has_prefix ? url.substr(url.find("//")+2) : url};
 	    auto hostname {get_hostname(tmp_url)};
 	    auto query {get_query(tmp_url)};
-	    return Url{url, hostname, port, query};
+	    return Url{url, hostname, port, query, scheme};
+	}
+
+	std::string Url::origin() const {
+	    if(!socket_path.empty()) return scheme + "://" + percent_encode(socket_path);
+	    return scheme + "://" + hostname + ":" + port;
+	}
+
+	// Schemes are case-insensitive; absolute locations are rewritten with a
+	// lowercase prefix before parsing.
+	static bool has_scheme(const std::string& location, std::string_view prefix) {
+	    return location.size() >= prefix.size() && strncasecmp(location.data(), prefix.data(), prefix.size()) == 0;
+	}
+
+	Url Url::resolve(const std::string& location) const {
+	    for(auto prefix: {http::prefix_http, http::prefix_https})
+		if(has_scheme(location, prefix))
+		    return parse(std::string{prefix} + location.substr(prefix.size()));
+	    if(has_scheme(location, http::prefix_http_unix))
+		return parse(std::string{http::prefix_http_unix} + location.substr(http::prefix_http_unix.size()));
+	    if(location.rfind("//", 0) == 0)
+		return parse(scheme + ":" + location);
+
+	    std::string path {query.substr(0, query.find('?'))};
+	    std::string target {};
+	    if(location.empty() || location.front() == '#')
+		target = query;
+	    else if(location.front() == '/')
+		target = location;
+	    else if(location.front() == '?')
+		target = path + location;
+	    else
+		target = path.substr(0, path.rfind('/')+1) + location;
+
+	    size_t end = target.find_first_of("?#");
+	    std::string rest {end == std::string::npos ? "" : target.substr(end)};
+	    target = remove_dot_segments(target.substr(0, end)) + rest;
+	    return parse(origin() + target);
 	}
 
     }